@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "ray.hpp"
+#include "vec3.hpp"
+#include "utils.hpp"
+
+class aabb_t
+{
+public:
+    point3_t min{ infinity, infinity, infinity };
+    point3_t max{ -infinity, -infinity, -infinity };
+
+    bool empty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    void expand( const point3_t &p )
+    {
+        min = point3_t{ std::min( min.x, p.x ), std::min( min.y, p.y ), std::min( min.z, p.z ) };
+        max = point3_t{ std::max( max.x, p.x ), std::max( max.y, p.y ), std::max( max.z, p.z ) };
+    }
+
+    void expand( const aabb_t &box )
+    {
+        if( box.empty() )
+            return;
+        expand( box.min );
+        expand( box.max );
+    }
+
+    point3_t center() const
+    {
+        return 0.5 * ( min + max );
+    }
+
+    // Index of the longest axis, 0 = x, 1 = y, 2 = z
+    int longest_axis() const
+    {
+        const vec3_t extent = max - min;
+        if( extent.x >= extent.y && extent.x >= extent.z )
+            return 0;
+        return extent.y >= extent.z ? 1 : 2;
+    }
+
+    double surface_area() const
+    {
+        if( empty() )
+            return 0.0;
+        const vec3_t e = max - min;
+        return 2.0 * ( e.x * e.y + e.y * e.z + e.z * e.x );
+    }
+};
+
+inline double axis( const vec3_t &v, int a )
+{
+    return a == 0 ? v.x : ( a == 1 ? v.y : v.z );
+}
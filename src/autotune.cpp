@@ -0,0 +1,377 @@
+#include "autotune.hpp"
+#include "topology.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+    // FNV-1a, unlike std::hash the same in every build
+    class fingerprint_t
+    {
+    public:
+        void add( const void *data, size_t size )
+        {
+            const auto *bytes = static_cast<const unsigned char *>( data );
+            for( size_t i = 0; i < size; i++ )
+                hash = ( hash ^ bytes[i] ) * 0x100000001b3ull;
+        }
+
+        void add( const std::string &text )
+        {
+            add( text.data(), text.size() );
+            add( uint64_t( text.size() ) );
+        }
+
+        void add( uint64_t value )
+        {
+            add( &value, sizeof( value ) );
+        }
+
+        void add( double value )
+        {
+            uint64_t bits;
+            std::memcpy( &bits, &value, sizeof( bits ) );
+            add( bits );
+        }
+
+        std::string hex() const
+        {
+            char text[17];
+            std::snprintf( text, sizeof( text ), "%016llx", static_cast<unsigned long long>( hash ) );
+            return text;
+        }
+
+    private:
+        uint64_t hash{ 0xcbf29ce484222325ull };
+    };
+
+    std::string cpu_model()
+    {
+        std::ifstream in( "/proc/cpuinfo" );
+        std::string line;
+        while( std::getline( in, line ) )
+        {
+            if( line.compare( 0, 10, "model name" ) == 0 )
+            {
+                const auto colon = line.find( ':' );
+                if( colon != std::string::npos )
+                    return line.substr( colon + 1 );
+            }
+        }
+        return "unknown";
+    }
+
+    double milliseconds_since( std::chrono::steady_clock::time_point start )
+    {
+        return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+    }
+
+    // Rays per second of one sample per pixel renders, one untimed render first to warm up caches and page tables
+    double measure( thread_pool_t &pool, const scene_t &scene, const render_settings_t &settings, double trial_ms )
+    {
+        TRACE_SCOPE( "autotune_trial" );
+
+        render_settings_t trial = settings;
+        trial.samples_per_pixel_x = 1;
+        trial.samples_per_pixel_y = 1;
+
+        const camera_t cam{ scene.camera, double( trial.image_width ) / trial.image_height, trial.image_height };
+
+        uint64_t rays = 0;
+        double render_ms = 0.0;
+        for( int pass = 0; pass == 0 || render_ms < trial_ms; pass++ )
+        {
+            std::vector<Job> jobs = create_jobs( trial, scene, cam );
+            image_t pixel( trial.image_height, std::vector<color_t>( trial.image_width ) );
+            std::vector<node_report_t> nodes;
+
+            const auto start = std::chrono::steady_clock::now();
+            render( pool, trial, jobs, pixel, false, numa_placement_t{}, &nodes );
+            if( pass == 0 )
+                continue;
+
+            render_ms += milliseconds_since( start );
+            for( const auto &node : nodes )
+                rays += node.rays;
+        }
+        return rays / ( render_ms / 1000.0 );
+    }
+
+    void log_trial( std::ostream &log, const tuned_settings_t &tuned, double rays_per_second )
+    {
+        log << "Autotune: leaf " << ( tuned.leaf_size > 0 ? std::to_string( tuned.leaf_size ) : "default" ) << ", "
+            << tuned.thread_count << " threads, " << tuned.tile_rows << " row tiles, " << tuned.packet_width << 'x'
+            << tuned.packet_width << " packets: " << rays_per_second / 1e6 << " Mrays/s\n";
+    }
+
+    // Candidate thread counts, a quarter of the CPUs at a time
+    std::vector<unsigned> thread_candidates()
+    {
+        const unsigned cpus = thread_pool_t::default_thread_count();
+        std::vector<unsigned> counts;
+        for( unsigned quarter = 1; quarter <= 4; quarter++ )
+        {
+            const unsigned count = std::max( 1u, cpus * quarter / 4 );
+            if( std::find( counts.begin(), counts.end(), count ) == counts.end() )
+                counts.push_back( count );
+        }
+        return counts;
+    }
+
+    std::string format_tuned( const std::string &key, const tuned_settings_t &tuned )
+    {
+        std::ostringstream line;
+        line << key << " tile_rows=" << tuned.tile_rows << " threads=" << tuned.thread_count
+             << " leaf=" << tuned.leaf_size << " packet_width=" << tuned.packet_width
+             << " rays_per_second=" << tuned.rays_per_second;
+        return line.str();
+    }
+
+    bool same_parameters( const tuned_settings_t &a, const tuned_settings_t &b )
+    {
+        return a.tile_rows == b.tile_rows && a.thread_count == b.thread_count && a.leaf_size == b.leaf_size
+               && a.packet_width == b.packet_width;
+    }
+
+    // The key is the first two fields of a line
+    bool line_has_key( const std::string &line, const std::string &key )
+    {
+        return line.size() > key.size() && line.compare( 0, key.size(), key ) == 0 && line[key.size()] == ' ';
+    }
+} // namespace
+
+std::string scene_fingerprint( const std::string &name, const scene_t &scene, const render_settings_t &settings )
+{
+    fingerprint_t fingerprint;
+    fingerprint.add( name );
+    fingerprint.add( uint64_t( scene.primitive_count ) );
+    fingerprint.add( uint64_t( scene.world.size() ) );
+    fingerprint.add( uint64_t( scene.lights.empty() ) );
+
+    const aabb_t bounds = scene.world.bounding_box();
+    for( const double v : { bounds.min.x, bounds.min.y, bounds.min.z, bounds.max.x, bounds.max.y, bounds.max.z } )
+        fingerprint.add( v );
+
+    fingerprint.add( uint64_t( settings.image_width ) );
+    fingerprint.add( uint64_t( settings.image_height ) );
+    fingerprint.add( uint64_t( settings.max_depth ) );
+    fingerprint.add( uint64_t( settings.sample_lights ) );
+    return fingerprint.hex();
+}
+
+std::string cpu_fingerprint()
+{
+    fingerprint_t fingerprint;
+    fingerprint.add( cpu_model() );
+    fingerprint.add( uint64_t( cpu_topology_t::machine().cpus().size() ) );
+    fingerprint.add( uint64_t( cpu_topology_t::machine().node_count() ) );
+    return fingerprint.hex();
+}
+
+std::string default_tune_cache_path()
+{
+    const std::string file = "raytracer-autotune.txt";
+
+    const char *cache = std::getenv( "XDG_CACHE_HOME" );
+    if( cache && *cache )
+        return std::string( cache ) + '/' + file;
+
+    const char *home = std::getenv( "HOME" );
+    if( home && *home )
+        return std::string( home ) + "/.cache/" + file;
+
+    return file;
+}
+
+bool load_tuned_settings( const std::string &path, const std::string &key, tuned_settings_t &tuned )
+{
+    std::ifstream in( path );
+    std::string line;
+    while( std::getline( in, line ) )
+    {
+        if( !line_has_key( line, key ) )
+            continue;
+
+        tuned_settings_t loaded;
+        std::istringstream fields( line.substr( key.size() ) );
+        std::string field;
+        while( fields >> field )
+        {
+            const auto equals = field.find( '=' );
+            if( equals == std::string::npos )
+                return false;
+
+            const std::string name = field.substr( 0, equals );
+            const std::string value = field.substr( equals + 1 );
+            try
+            {
+                if( name == "tile_rows" )
+                    loaded.tile_rows = std::stoi( value );
+                else if( name == "threads" )
+                    loaded.thread_count = static_cast<unsigned>( std::stoul( value ) );
+                else if( name == "leaf" )
+                    loaded.leaf_size = std::stoi( value );
+                else if( name == "packet_width" )
+                    loaded.packet_width = std::stoi( value );
+                else if( name == "rays_per_second" )
+                    loaded.rays_per_second = std::stod( value );
+            }
+            catch( const std::exception & )
+            {
+                return false;
+            }
+        }
+
+        if( loaded.tile_rows <= 0 || loaded.thread_count == 0 || loaded.leaf_size < 0 || loaded.packet_width <= 0 )
+            return false;
+        tuned = loaded;
+        return true;
+    }
+    return false;
+}
+
+bool store_tuned_settings( const std::string &path, const std::string &key, const tuned_settings_t &tuned )
+{
+    // Keep the other entries, replace this one
+    std::vector<std::string> lines;
+    {
+        std::ifstream in( path );
+        std::string line;
+        while( std::getline( in, line ) )
+        {
+            if( !line.empty() && !line_has_key( line, key ) )
+                lines.push_back( line );
+        }
+    }
+    lines.push_back( format_tuned( key, tuned ) );
+
+    const std::filesystem::path parent = std::filesystem::path( path ).parent_path();
+    std::error_code error;
+    if( !parent.empty() )
+        std::filesystem::create_directories( parent, error );
+
+    // Written next to the file and renamed, so a concurrent reader never sees half of it
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream out( temporary, std::ios::trunc );
+        for( const auto &line : lines )
+            out << line << '\n';
+        if( !out.flush() )
+            return false;
+    }
+    return std::rename( temporary.c_str(), path.c_str() ) == 0;
+}
+
+tuned_settings_t autotune( const std::string &scene_name,
+                           std::shared_ptr<scene_t> &scene,
+                           const render_settings_t &settings,
+                           double trial_ms,
+                           std::ostream &log )
+{
+    TRACE_SCOPE( "autotune" );
+
+    constexpr double min_gain = 1.03;
+
+    tuned_settings_t best;
+    best.thread_count = thread_pool_t::default_thread_count();
+
+    const auto apply = [&settings]( const tuned_settings_t &tuned )
+    {
+        render_settings_t applied = settings;
+        applied.tile_rows = tuned.tile_rows;
+        applied.packet_width = tuned.packet_width;
+        return applied;
+    };
+
+    // Tries the candidates of one parameter, candidate 0 with the scene and pool at hand
+    const auto search = [&]( size_t candidate_count,
+                             const std::function<void( size_t, tuned_settings_t & )> &set,
+                             const std::function<double( const tuned_settings_t & )> &run )
+    {
+        tuned_settings_t round_best = best;
+        round_best.rays_per_second = 0.0;
+        double current_rays_per_second = 0.0;
+        for( size_t i = 0; i < candidate_count; i++ )
+        {
+            tuned_settings_t candidate = best;
+            set( i, candidate );
+            candidate.rays_per_second = run( candidate );
+            log_trial( log, candidate, candidate.rays_per_second );
+            if( same_parameters( candidate, best ) )
+                current_rays_per_second = candidate.rays_per_second;
+            if( candidate.rays_per_second > round_best.rays_per_second )
+                round_best = candidate;
+        }
+
+        // Differences within the noise of short trials keep the value the search started from
+        if( round_best.rays_per_second >= min_gain * current_rays_per_second )
+            best = round_best;
+        else
+            best.rays_per_second = current_rays_per_second;
+    };
+
+    {
+        // The scene at hand has the default leaf sizes
+        thread_pool_t pool( best.thread_count );
+        const int leaf_sizes[] = { 0, 1, 2, 4, 8 };
+        std::shared_ptr<scene_t> best_scene = scene;
+        double best_scene_rays_per_second = 0.0;
+        search(
+            std::size( leaf_sizes ),
+            [&]( size_t i, tuned_settings_t &tuned ) { tuned.leaf_size = leaf_sizes[i]; },
+            [&]( const tuned_settings_t &tuned )
+            {
+                std::shared_ptr<scene_t> candidate = tuned.leaf_size > 0 ? make_scene( scene_name, tuned.leaf_size )
+                                                                         : scene;
+                if( !candidate )
+                    return 0.0;
+
+                const double rays_per_second = measure( pool, *candidate, apply( tuned ), trial_ms );
+                if( rays_per_second > best_scene_rays_per_second )
+                {
+                    best_scene_rays_per_second = rays_per_second;
+                    best_scene = candidate;
+                }
+                return rays_per_second;
+            } );
+        if( best.leaf_size > 0 )
+            scene = best_scene;
+    }
+
+    const std::vector<unsigned> thread_counts = thread_candidates();
+    search(
+        thread_counts.size(),
+        [&]( size_t i, tuned_settings_t &tuned ) { tuned.thread_count = thread_counts[i]; },
+        [&]( const tuned_settings_t &tuned )
+        {
+            thread_pool_t pool( tuned.thread_count );
+            return measure( pool, *scene, apply( tuned ), trial_ms );
+        } );
+
+    thread_pool_t pool( best.thread_count );
+
+    const int tile_rows[] = { packet_size, 2 * packet_size, 4 * packet_size };
+    search(
+        std::size( tile_rows ),
+        [&]( size_t i, tuned_settings_t &tuned ) { tuned.tile_rows = tile_rows[i]; },
+        [&]( const tuned_settings_t &tuned ) { return measure( pool, *scene, apply( tuned ), trial_ms ); } );
+
+    const int packet_widths[] = { packet_size / 4, packet_size / 2, packet_size };
+    search(
+        std::size( packet_widths ),
+        [&]( size_t i, tuned_settings_t &tuned ) { tuned.packet_width = packet_widths[i]; },
+        [&]( const tuned_settings_t &tuned ) { return measure( pool, *scene, apply( tuned ), trial_ms ); } );
+
+    return best;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "renderer.hpp"
+#include "scene.hpp"
+
+// Render parameters that depend on the scene and the machine
+class tuned_settings_t
+{
+public:
+    int tile_rows{ packet_size };
+    unsigned thread_count{ thread_pool_t::default_thread_count() };
+    int leaf_size{ 0 }; // 0 for the scene's defaults
+    int packet_width{ packet_size };
+    double rays_per_second{ 0.0 }; // measured with these settings
+};
+
+// Identifies the scene and the render settings that change its cost, in hex. Stable across builds and machines.
+[[nodiscard]] std::string scene_fingerprint( const std::string &name,
+                                             const scene_t &scene,
+                                             const render_settings_t &settings );
+
+// Hash of the CPU model and the number of CPUs this process may use, in hex
+[[nodiscard]] std::string cpu_fingerprint();
+
+// Tuning results are kept in a text file, one line per scene and CPU fingerprint:
+//     SCENE CPU tile_rows=R threads=T leaf=L packet_width=W rays_per_second=X
+// The default file is raytracer-autotune.txt in $XDG_CACHE_HOME or ~/.cache, else in the working directory.
+[[nodiscard]] std::string default_tune_cache_path();
+bool load_tuned_settings( const std::string &path, const std::string &key, tuned_settings_t &tuned );
+bool store_tuned_settings( const std::string &path, const std::string &key, const tuned_settings_t &tuned );
+
+// Short renders of the scene at one sample per pixel, each repeated for at least trial_ms, choosing the settings
+// with the most rays per second. The parameters are searched one at a time, each keeping the best value found for
+// the ones before: leaf size, which rebuilds the scene for every candidate, then thread count, tile rows and packet
+// width. A value replaces the default only when it is at least 3% faster. scene is the scene built with the default
+// leaf sizes and is replaced by the best build. Every trial is written to log.
+[[nodiscard]] tuned_settings_t autotune( const std::string &scene_name,
+                                         std::shared_ptr<scene_t> &scene,
+                                         const render_settings_t &settings,
+                                         double trial_ms,
+                                         std::ostream &log );
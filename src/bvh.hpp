@@ -0,0 +1,459 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <vector>
+
+#include "aabb.hpp"
+#include "ray.hpp"
+#include "ray_packet.hpp"
+#include "vec3.hpp"
+
+// Bounding volume hierarchy over primitives identified by index, stored as a flat array of 32 byte nodes.
+// The owner keeps the primitives, the hierarchy only knows their bounds. Leaves refer to a range of slots,
+// order() maps slots back to primitive indices (owners may instead reorder their primitives by it and release it).
+class bvh_t
+{
+public:
+    struct node_t
+    {
+        float min[3];
+        float max[3];
+        uint32_t offset; // leaf: first slot, inner: index of the right child, the left child follows the node
+        uint16_t count;  // number of slots in a leaf, 0 for inner nodes
+        uint16_t axis;   // split axis of inner nodes
+    };
+
+    static_assert( sizeof( node_t ) == 32, "bvh node should stay at half a cache line" );
+
+    // Median split on the longest centroid axis. Subtrees are built as OpenMP tasks, every node's position in the
+    // array is known up front so the layout does not depend on the thread count.
+    template <typename bounds_of_t>
+    void build( size_t count, int leaf_size, bounds_of_t &&bounds_of );
+
+    bool empty() const
+    {
+        return nodes_.empty();
+    }
+
+    const std::vector<uint32_t> &order() const
+    {
+        return order_;
+    }
+
+    void release_order()
+    {
+        order_ = std::vector<uint32_t>();
+    }
+
+    int leaf_size() const
+    {
+        return leaf_size_;
+    }
+
+    size_t node_count() const
+    {
+        return nodes_.size();
+    }
+
+    size_t memory_bytes() const
+    {
+        return nodes_.capacity() * sizeof( node_t ) + order_.capacity() * sizeof( uint32_t );
+    }
+
+    aabb_t bounds() const
+    {
+        return nodes_.empty() ? aabb_t{} : to_aabb( nodes_[0] );
+    }
+
+    // Number of nodes the hierarchy over count primitives has
+    static size_t subtree_nodes( size_t count, int leaf_size );
+
+    // Memory of the order table, which lives until release_order(), and of everything build() allocates besides the
+    // nodes: the order table and the centroids
+    static size_t order_bytes( size_t count )
+    {
+        return count * sizeof( uint32_t );
+    }
+
+    static size_t build_scratch_bytes( size_t count )
+    {
+        return count * ( sizeof( uint32_t ) + sizeof( centroid_t ) );
+    }
+
+    // Calls hit_leaf( first_slot, slot_count, t_max ) for every leaf the ray enters before t_max, near child first.
+    // hit_leaf returns true when it found a hit and then lowers t_max to it, or below t_min to stop right away.
+    template <typename hit_leaf_t>
+    bool traverse( const ray_t &r, double t_min, double t_max, hit_leaf_t &&hit_leaf ) const;
+
+    // Calls hit_leaf( first_slot, slot_count ) for every leaf that any ray of the packet may enter before its t_max,
+    // near child first along the direction the rays share. hit_leaf records closer hits in the packet.
+    template <typename hit_leaf_t>
+    void traverse_packet( ray_packet_t &packet, double t_min, hit_leaf_t &&hit_leaf ) const;
+
+    // Recomputes the bounds of the leaf holding slot and of its ancestors after that primitive changed. The tree
+    // keeps its structure, so large moves make it looser. bounds_of takes a slot, not a primitive index.
+    template <typename slot_bounds_of_t>
+    void refit( uint32_t slot, slot_bounds_of_t &&bounds_of );
+
+    // Stops at the first leaf for which hit_leaf( first_slot, slot_count ) returns true
+    template <typename hit_leaf_t>
+    bool traverse_any( const ray_t &r, double t_min, double t_max, hit_leaf_t &&hit_leaf ) const;
+
+private:
+    template <typename bounds_of_t>
+    void build_node( uint32_t node_index, uint32_t begin, uint32_t end, bounds_of_t &bounds_of );
+
+    static size_t count_nodes( size_t count, int leaf_size, std::map<size_t, size_t> &memo );
+    static void set_bounds( node_t &node, const aabb_t &box );
+    static aabb_t to_aabb( const node_t &node );
+    static void merge_bounds( node_t &node, const node_t &a, const node_t &b );
+
+    static bool intersect(
+        const node_t &node, const point3_t &origin, const double inv_direction[3], double t_min, double t_max );
+
+private:
+    struct centroid_t
+    {
+        float v[3];
+    };
+
+    std::vector<node_t> nodes_;
+    std::vector<uint32_t> order_;
+    std::vector<centroid_t> centroids;      // only during build
+    std::map<size_t, size_t> subtree_sizes; // subtree_nodes for the handful of range sizes a median split produces
+    int leaf_size_{ 4 };
+
+    static constexpr uint32_t parallel_threshold = 16 * 1024;
+};
+
+inline size_t bvh_t::count_nodes( size_t count, int leaf_size, std::map<size_t, size_t> &memo )
+{
+    if( count <= size_t( leaf_size ) )
+        return 1;
+
+    const auto it = memo.find( count );
+    if( it != memo.end() )
+        return it->second;
+
+    // A median split only ever produces ranges of floor and ceil of count / 2^depth, so this stays logarithmic
+    const size_t left = count / 2;
+    const size_t nodes = 1 + count_nodes( left, leaf_size, memo ) + count_nodes( count - left, leaf_size, memo );
+    memo[count] = nodes;
+    return nodes;
+}
+
+inline size_t bvh_t::subtree_nodes( size_t count, int leaf_size )
+{
+    std::map<size_t, size_t> memo;
+    return count_nodes( count, leaf_size, memo );
+}
+
+template <typename bounds_of_t>
+void bvh_t::build( size_t count, int leaf_size, bounds_of_t &&bounds_of )
+{
+    leaf_size_ = std::clamp( leaf_size, 1, 0xffff );
+    nodes_.clear();
+    order_.resize( count );
+    std::iota( order_.begin(), order_.end(), 0u );
+
+    if( count == 0 )
+        return;
+
+    subtree_sizes.clear();
+    nodes_.resize( count_nodes( count, leaf_size_, subtree_sizes ) );
+
+    // Splitting compares centroids over and over, cache them for the duration of the build
+    centroids.resize( count );
+    const int64_t n = static_cast<int64_t>( count );
+#pragma omp parallel for schedule( static )
+    for( int64_t i = 0; i < n; i++ )
+    {
+        const point3_t c = bounds_of( uint32_t( i ) ).center();
+        centroids[i] = centroid_t{ float( c.x ), float( c.y ), float( c.z ) };
+    }
+
+#pragma omp parallel
+#pragma omp single
+    build_node( 0, 0, static_cast<uint32_t>( count ), bounds_of );
+
+    centroids = std::vector<centroid_t>();
+}
+
+template <typename bounds_of_t>
+void bvh_t::build_node( uint32_t node_index, uint32_t begin, uint32_t end, bounds_of_t &bounds_of )
+{
+    node_t &node = nodes_[node_index];
+    const uint32_t count = end - begin;
+
+    if( count <= uint32_t( leaf_size_ ) )
+    {
+        aabb_t box;
+        for( uint32_t i = begin; i < end; i++ )
+            box.expand( bounds_of( order_[i] ) );
+
+        set_bounds( node, box );
+        node.offset = begin;
+        node.count = static_cast<uint16_t>( count );
+        node.axis = 0;
+        return;
+    }
+
+    aabb_t centroid_bounds;
+    for( uint32_t i = begin; i < end; i++ )
+    {
+        const centroid_t &c = centroids[order_[i]];
+        centroid_bounds.expand( point3_t{ c.v[0], c.v[1], c.v[2] } );
+    }
+
+    const int split_axis = centroid_bounds.longest_axis();
+    const uint32_t middle = begin + count / 2;
+
+    std::nth_element( order_.begin() + begin,
+                      order_.begin() + middle,
+                      order_.begin() + end,
+                      [this, split_axis]( uint32_t a, uint32_t b )
+                      { return centroids[a].v[split_axis] < centroids[b].v[split_axis]; } );
+
+    const uint32_t left = node_index + 1;
+    const uint32_t left_count = middle - begin;
+    const uint32_t right
+        = static_cast<uint32_t>( left + ( left_count <= uint32_t( leaf_size_ ) ? 1 : subtree_sizes.at( left_count ) ) );
+
+#pragma omp task if( count > parallel_threshold ) default( shared ) firstprivate( left, begin, middle )
+    build_node( left, begin, middle, bounds_of );
+
+    build_node( right, middle, end, bounds_of );
+
+#pragma omp taskwait
+
+    node.offset = right;
+    node.count = 0;
+    node.axis = static_cast<uint16_t>( split_axis );
+    merge_bounds( node, nodes_[left], nodes_[right] );
+}
+
+inline void bvh_t::set_bounds( node_t &node, const aabb_t &box )
+{
+    // Round outwards so the float box still contains the double precision primitive
+    const double lo[3] = { box.min.x, box.min.y, box.min.z };
+    const double hi[3] = { box.max.x, box.max.y, box.max.z };
+    for( int a = 0; a < 3; a++ )
+    {
+        node.min[a] = static_cast<float>( lo[a] );
+        if( node.min[a] > lo[a] )
+            node.min[a] = std::nextafter( node.min[a], -std::numeric_limits<float>::infinity() );
+
+        node.max[a] = static_cast<float>( hi[a] );
+        if( node.max[a] < hi[a] )
+            node.max[a] = std::nextafter( node.max[a], std::numeric_limits<float>::infinity() );
+    }
+}
+
+inline aabb_t bvh_t::to_aabb( const node_t &node )
+{
+    return aabb_t{ point3_t{ node.min[0], node.min[1], node.min[2] },
+                   point3_t{ node.max[0], node.max[1], node.max[2] } };
+}
+
+inline void bvh_t::merge_bounds( node_t &node, const node_t &a, const node_t &b )
+{
+    for( int i = 0; i < 3; i++ )
+    {
+        node.min[i] = std::min( a.min[i], b.min[i] );
+        node.max[i] = std::max( a.max[i], b.max[i] );
+    }
+}
+
+inline bool bvh_t::intersect(
+    const node_t &node, const point3_t &origin, const double inv_direction[3], double t_min, double t_max )
+{
+    const double o[3] = { origin.x, origin.y, origin.z };
+    for( int a = 0; a < 3; a++ )
+    {
+        double t0 = ( node.min[a] - o[a] ) * inv_direction[a];
+        double t1 = ( node.max[a] - o[a] ) * inv_direction[a];
+        if( inv_direction[a] < 0.0 )
+            std::swap( t0, t1 );
+
+        // Written so that NaN from 0 * inf leaves the interval unchanged
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if( t_max < t_min )
+            return false;
+    }
+    return true;
+}
+
+template <typename hit_leaf_t>
+bool bvh_t::traverse( const ray_t &r, double t_min, double t_max, hit_leaf_t &&hit_leaf ) const
+{
+    if( nodes_.empty() )
+        return false;
+
+    const point3_t origin = r.origin();
+    const vec3_t direction = r.direction();
+    const double inv_direction[3] = { 1.0 / direction.x, 1.0 / direction.y, 1.0 / direction.z };
+
+    uint32_t stack[64];
+    int stack_size = 0;
+    uint32_t index = 0;
+    bool hit_anything = false;
+
+    while( true )
+    {
+        const node_t &node = nodes_[index];
+        if( intersect( node, origin, inv_direction, t_min, t_max ) )
+        {
+            if( node.count > 0 )
+            {
+                if( hit_leaf( node.offset, node.count, t_max ) )
+                {
+                    hit_anything = true;
+
+                    // Lowering t_max below t_min ends the traversal, traverse_any uses it
+                    if( t_max < t_min )
+                        break;
+                }
+            }
+            else
+            {
+                uint32_t near_child = index + 1;
+                uint32_t far_child = node.offset;
+                if( inv_direction[node.axis] < 0.0 )
+                    std::swap( near_child, far_child );
+
+                stack[stack_size++] = far_child;
+                index = near_child;
+                continue;
+            }
+        }
+
+        if( stack_size == 0 )
+            break;
+        index = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+template <typename hit_leaf_t>
+void bvh_t::traverse_packet( ray_packet_t &packet, double t_min, hit_leaf_t &&hit_leaf ) const
+{
+    if( nodes_.empty() )
+        return;
+
+    // Each entry keeps the rays that entered the parent, from the first one that entered this node on
+    struct entry_t
+    {
+        uint32_t index;
+        uint64_t rays;
+    };
+
+    const uint64_t active = packet.active();
+    entry_t stack[64];
+    int stack_size = 0;
+    entry_t entry{ 0, active };
+    double t_max = packet.max_t_max();
+
+    while( true )
+    {
+        const node_t &node = nodes_[entry.index];
+        if( packet.may_hit( node.min, node.max, t_min, t_max ) )
+        {
+            if( node.count > 0 )
+            {
+                const uint64_t rays = packet.rays_may_hit( entry.rays, node.min, node.max, t_min );
+                if( rays != 0 )
+                {
+                    packet.set_active( rays );
+                    hit_leaf( node.offset, node.count );
+                    t_max = packet.max_t_max();
+                }
+            }
+            else
+            {
+                const uint64_t rays = packet.first_may_hit( entry.rays, node.min, node.max, t_min );
+                if( rays != 0 )
+                {
+                    uint32_t near_child = entry.index + 1;
+                    uint32_t far_child = node.offset;
+                    if( packet.direction_sign( node.axis ) < 0 )
+                        std::swap( near_child, far_child );
+
+                    stack[stack_size++] = entry_t{ far_child, rays };
+                    entry = entry_t{ near_child, rays };
+                    continue;
+                }
+            }
+        }
+
+        if( stack_size == 0 )
+            break;
+        entry = stack[--stack_size];
+    }
+
+    packet.set_active( active );
+}
+
+template <typename slot_bounds_of_t>
+void bvh_t::refit( uint32_t slot, slot_bounds_of_t &&bounds_of )
+{
+    if( nodes_.empty() )
+        return;
+
+    // Every subtree covers a contiguous range of slots and the left child takes the first half of it, so the
+    // path to the slot's leaf follows from the range alone
+    uint32_t path[64];
+    int depth = 0;
+    uint32_t index = 0;
+    uint32_t begin = 0;
+    uint32_t end = static_cast<uint32_t>( order_.size() );
+
+    while( nodes_[index].count == 0 )
+    {
+        path[depth++] = index;
+        const uint32_t middle = begin + ( end - begin ) / 2;
+        if( slot < middle )
+        {
+            index = index + 1;
+            end = middle;
+        }
+        else
+        {
+            index = nodes_[index].offset;
+            begin = middle;
+        }
+    }
+
+    node_t &leaf = nodes_[index];
+    aabb_t box;
+    for( uint32_t i = leaf.offset; i < leaf.offset + leaf.count; i++ )
+        box.expand( bounds_of( i ) );
+    set_bounds( leaf, box );
+
+    while( depth > 0 )
+    {
+        const uint32_t parent = path[--depth];
+        merge_bounds( nodes_[parent], nodes_[parent + 1], nodes_[nodes_[parent].offset] );
+    }
+}
+
+template <typename hit_leaf_t>
+bool bvh_t::traverse_any( const ray_t &r, double t_min, double t_max, hit_leaf_t &&hit_leaf ) const
+{
+    return traverse( r,
+                     t_min,
+                     t_max,
+                     [&hit_leaf]( uint32_t first, uint32_t count, double &t_limit )
+                     {
+                         if( !hit_leaf( first, count ) )
+                             return false;
+                         t_limit = -infinity;
+                         return true;
+                     } );
+}
@@ -4,6 +4,17 @@
 #include "vec3.hpp"
 #include "utils.hpp"
 
+class camera_settings_t
+{
+public:
+    point3_t lookfrom{ 13.0, 2.0, 3.0 };
+    point3_t lookat{ 0.0, 0.0, 0.0 };
+    vec3_t vup{ 0.0, 1.0, 0.0 };
+    double vfov{ 20.0 }; // vertical field-of-view in degrees
+    double aperture{ 0.1 };
+    double focus_dist{ 10.0 };
+};
+
 class camera_t
 {
 public:
@@ -13,7 +24,8 @@ public:
               double vfov, // vertical field-of-view in degrees
               double aspect_ratio,
               double aperture,
-              double focus_dist )
+              double focus_dist,
+              int image_height = 0 )
     {
         const auto theta = degrees_to_radians( vfov );
         const auto h = tan( theta / 2.0 );
@@ -30,6 +42,21 @@ public:
         lower_left_corner = origin - horizontal / 2 - vertical / 2 - focus_dist * w;
 
         lens_radius = aperture / 2;
+
+        // Angle covered by one pixel, rays start with it as their spread
+        pixel_spread = image_height > 1 ? viewport_height / ( image_height - 1 ) : 0.0;
+    }
+
+    camera_t( const camera_settings_t &settings, double aspect_ratio, int image_height = 0 )
+        : camera_t( settings.lookfrom,
+                    settings.lookat,
+                    settings.vup,
+                    settings.vfov,
+                    aspect_ratio,
+                    settings.aperture,
+                    settings.focus_dist,
+                    image_height )
+    {
     }
 
     ray_t get_ray( random_number_generator_t &rng, double s, double t ) const
@@ -37,7 +64,8 @@ public:
         const vec3_t rd = lens_radius * rng.random_in_unit_disk();
         const vec3_t offset = u * rd.x + v * rd.y;
 
-        return ray_t( origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset );
+        return ray_t(
+            origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, pixel_spread );
     }
 
 private:
@@ -49,4 +77,5 @@ private:
     vec3_t v;
     vec3_t w;
     double lens_radius;
+    double pixel_spread;
 };
@@ -54,10 +54,21 @@ public:
         else
             direction = refract( unit_direction, rec.normal, refraction_ratio );
 
-        scattered = ray_t( rec.p, direction );
+        scattered = ray_t( rec.p, direction, r_in.spread() );
         return true;
     }
 
+    virtual bool same_as( const material_t &other ) const override
+    {
+        const auto *o = dynamic_cast<const dielectric_t *>( &other );
+        return o && o->ir == ir;
+    }
+
+    virtual size_t hash() const override
+    {
+        return hash_values( { 3.0, ir } );
+    }
+
     static double reflectance( double cosine, double ref_idx )
     {
         // Use Schlick's approximation for reflectance.
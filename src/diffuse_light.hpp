@@ -0,0 +1,48 @@
+#pragma once
+
+#include "material.hpp"
+
+// Emits light from its front face and absorbs everything that hits it
+class diffuse_light_t : public material_t
+{
+public:
+    diffuse_light_t( const color_t &e ) : emit( e ) { }
+
+    virtual color_t diffuse() const override
+    {
+        return color_t{ 0.0, 0.0, 0.0 };
+    }
+
+    virtual bool scatter( const ray_t &r_in,
+                          const hit_record_t &rec,
+                          random_number_generator_t &rng,
+                          color_t &attenuation,
+                          ray_t &scattered ) const override
+    {
+        return false;
+    }
+
+    virtual color_t emitted( const hit_record_t &rec ) const override
+    {
+        return rec.front_face ? emit : color_t{ 0.0, 0.0, 0.0 };
+    }
+
+    virtual bool same_as( const material_t &other ) const override
+    {
+        const auto *o = dynamic_cast<const diffuse_light_t *>( &other );
+        return o && o->emit == emit;
+    }
+
+    virtual size_t hash() const override
+    {
+        return hash_values( { 4.0, emit.x, emit.y, emit.z } );
+    }
+
+    const color_t &emission() const
+    {
+        return emit;
+    }
+
+private:
+    color_t emit;
+};
@@ -5,6 +5,17 @@
 #include "vec3.hpp"
 
 class material_t;
+class hittable_t;
+
+// Texture coordinates of a hit and the width of the ray footprint along each of them
+class texture_coordinates_t
+{
+public:
+    double u{ 0.0 };
+    double v{ 0.0 };
+    double du{ 0.0 };
+    double dv{ 0.0 };
+};
 
 class hit_record_t
 {
@@ -12,7 +23,9 @@ public:
     point3_t p;
     vec3_t normal;
     std::shared_ptr<material_t> material;
+    const hittable_t *object{ nullptr }; // primitive that was hit, used to look up lights
     double t;
+    double footprint{ 0.0 }; // width of the ray footprint at p, set by objects that map textures
     bool front_face;
 
     void set_face_normal( const ray_t &r, const vec3_t &outward_normal )
@@ -1,10 +1,54 @@
 #pragma once
 
 #include "ray.hpp"
+#include "ray_packet.hpp"
 #include "hit_record.hpp"
+#include "aabb.hpp"
+#include "utils.hpp"
 
 class hittable_t
 {
 public:
     virtual bool hit( const ray_t &r, double t_min, double t_max, hit_record_t &rec ) const = 0;
+    virtual aabb_t bounding_box() const = 0;
+
+    // Shadow ray query, returns at the first hit found instead of the closest one
+    virtual bool hit_any( const ray_t &r, double t_min, double t_max ) const
+    {
+        hit_record_t rec;
+        return hit( r, t_min, t_max, rec );
+    }
+
+    // Closest hits of the active rays of a packet, every ray with a hit nearer than its t_max is updated. By default
+    // the packet is tested against the bounding box once and then ray by ray.
+    virtual void hit_packet( ray_packet_t &packet, double t_min ) const
+    {
+        if( !packet.may_hit( bounding_box(), t_min, packet.max_t_max() ) )
+            return;
+
+        hit_record_t rec;
+        packet.for_each_active(
+            [&]( int i )
+            {
+                if( hit( packet.ray( i ), t_min, packet.t_max( i ), rec ) )
+                    packet.set_hit( i, rec );
+            } );
+    }
+
+    // Texture coordinates of rec, false for objects without a texture mapping
+    virtual bool texture_coordinates( const hit_record_t &rec, texture_coordinates_t &uv ) const
+    {
+        return false;
+    }
+
+    // Objects used as lights: solid angle density of random_direction() from origin towards direction
+    virtual double pdf_value( const point3_t &origin, const vec3_t &direction ) const
+    {
+        return 0.0;
+    }
+
+    virtual vec3_t random_direction( const point3_t &origin, random_number_generator_t &rng ) const
+    {
+        return vec3_t{ 1.0, 0.0, 0.0 };
+    }
 };
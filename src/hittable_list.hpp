@@ -1,9 +1,11 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <memory>
 
 #include "hittable.hpp"
+#include "bvh.hpp"
 
 class hittable_list_t : public hittable_t
 {
@@ -17,14 +19,62 @@ public:
     void clear()
     {
         objects.clear();
+        bvh = bvh_t{};
     }
     void add( std::shared_ptr<hittable_t> object )
     {
         objects.push_back( object );
+        bvh = bvh_t{};
+    }
+
+    size_t size() const
+    {
+        return objects.size();
+    }
+
+    const std::shared_ptr<hittable_t> &object( size_t index ) const
+    {
+        return objects[index];
+    }
+
+    // Swaps one object for another, an existing hierarchy is refit instead of rebuilt
+    void replace( size_t index, std::shared_ptr<hittable_t> object )
+    {
+        objects[index] = std::move( object );
+
+        if( !bvh.empty() )
+        {
+            const auto &order = bvh.order();
+            const auto slot = std::find( order.begin(), order.end(), uint32_t( index ) ) - order.begin();
+            bvh.refit( static_cast<uint32_t>( slot ),
+                       [this, &order]( uint32_t slot ) { return objects[order[slot]]->bounding_box(); } );
+        }
+    }
+
+    // Objects added afterwards drop the hierarchy again, hit() then falls back to testing every object.
+    // Short lists are faster to test one by one and keep no hierarchy.
+    void build_bvh( int leaf_size = 2 )
+    {
+        constexpr size_t min_objects = 8;
+        if( objects.size() < min_objects )
+        {
+            bvh = bvh_t{};
+            return;
+        }
+
+        std::vector<aabb_t> bounds;
+        bounds.reserve( objects.size() );
+        for( const auto &object : objects )
+            bounds.push_back( object->bounding_box() );
+
+        bvh.build( bounds.size(), leaf_size, [&bounds]( uint32_t i ) -> const aabb_t & { return bounds[i]; } );
     }
 
     virtual bool hit( const ray_t &r, double t_min, double t_max, hit_record_t &rec ) const override
     {
+        if( !bvh.empty() )
+            return hit_bvh( r, t_min, t_max, rec );
+
         hit_record_t temp_rec;
         bool hit_anything = false;
         auto closest_so_far = t_max;
@@ -42,6 +92,86 @@ public:
         return hit_anything;
     }
 
+    virtual bool hit_any( const ray_t &r, double t_min, double t_max ) const override
+    {
+        if( !bvh.empty() )
+        {
+            const auto &order = bvh.order();
+            return bvh.traverse_any( r,
+                                     t_min,
+                                     t_max,
+                                     [&]( uint32_t first, uint32_t count )
+                                     {
+                                         for( uint32_t slot = first; slot < first + count; slot++ )
+                                         {
+                                             if( objects[order[slot]]->hit_any( r, t_min, t_max ) )
+                                                 return true;
+                                         }
+                                         return false;
+                                     } );
+        }
+
+        for( const auto &object : objects )
+        {
+            if( object->hit_any( r, t_min, t_max ) )
+                return true;
+        }
+        return false;
+    }
+
+    virtual void hit_packet( ray_packet_t &packet, double t_min ) const override
+    {
+        if( bvh.empty() )
+        {
+            for( const auto &object : objects )
+                object->hit_packet( packet, t_min );
+            return;
+        }
+
+        const auto &order = bvh.order();
+        bvh.traverse_packet( packet,
+                             t_min,
+                             [&]( uint32_t first, uint32_t count )
+                             {
+                                 for( uint32_t slot = first; slot < first + count; slot++ )
+                                     objects[order[slot]]->hit_packet( packet, t_min );
+                             } );
+    }
+
+    virtual aabb_t bounding_box() const override
+    {
+        aabb_t box;
+        for( const auto &object : objects )
+            box.expand( object->bounding_box() );
+        return box;
+    }
+
+private:
+    bool hit_bvh( const ray_t &r, double t_min, double t_max, hit_record_t &rec ) const
+    {
+        hit_record_t temp_rec;
+        const auto &order = bvh.order();
+
+        return bvh.traverse( r,
+                             t_min,
+                             t_max,
+                             [&]( uint32_t first, uint32_t count, double &closest_so_far )
+                             {
+                                 bool hit_anything = false;
+                                 for( uint32_t slot = first; slot < first + count; slot++ )
+                                 {
+                                     if( objects[order[slot]]->hit( r, t_min, closest_so_far, temp_rec ) )
+                                     {
+                                         hit_anything = true;
+                                         closest_so_far = temp_rec.t;
+                                         rec = temp_rec;
+                                     }
+                                 }
+                                 return hit_anything;
+                             } );
+    }
+
 private:
     std::vector<std::shared_ptr<hittable_t>> objects;
+    bvh_t bvh;
 };
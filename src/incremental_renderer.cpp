@@ -0,0 +1,195 @@
+#include <algorithm>
+
+#include "incremental_renderer.hpp"
+#include "perf_counters.hpp"
+#include "trace.hpp"
+
+namespace
+{
+    // Fine cells of the footprint grid; a segment costs a step per cell it crosses
+    constexpr size_t grid_cells = size_t( 1 ) << 14;
+
+    // Objects this many times larger than the median one, like a ground sphere, are left out of the grid's region
+    constexpr double large_object_factor = 16.0;
+
+    // Bounds of the world without its outsized objects, which would make every cell larger than what is edited.
+    // Segments outside the region are still noticed, just not located.
+    aabb_t footprint_region( const hittable_list_t &world )
+    {
+        std::vector<aabb_t> boxes;
+        std::vector<double> extents;
+        for( size_t i = 0; i < world.size(); i++ )
+        {
+            const aabb_t box = world.object( i )->bounding_box();
+            if( box.empty() )
+                continue;
+            const vec3_t extent = box.max - box.min;
+            boxes.push_back( box );
+            extents.push_back( std::max( { extent.x, extent.y, extent.z } ) );
+        }
+        if( boxes.empty() )
+            return aabb_t{};
+
+        std::vector<double> sorted = extents;
+        std::nth_element( sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end() );
+        const double median = sorted[sorted.size() / 2];
+        const double limit = large_object_factor * median;
+
+        aabb_t region;
+        for( size_t i = 0; i < boxes.size(); i++ )
+        {
+            if( extents[i] <= limit )
+                region.expand( boxes[i] );
+        }
+        // Reaching a median object past the others keeps a nearby move inside the region
+        const vec3_t margin{ median, median, median };
+        return aabb_t{ region.min - margin, region.max + margin };
+    }
+} // namespace
+
+incremental_renderer_t::incremental_renderer_t( thread_pool_t &pool,
+                                                std::shared_ptr<scene_t> scene,
+                                                const render_settings_t &settings,
+                                                int tile_size )
+    : pool( pool ),
+      scene( std::move( scene ) ),
+      settings( settings ),
+      cam( this->scene->camera, double( settings.image_width ) / settings.image_height, settings.image_height ),
+      grid( footprint_region( this->scene->world ), grid_cells )
+{
+    jobs = create_jobs( settings, *this->scene, cam );
+
+    tile_size = std::max( 1, tile_size );
+    for( int y0 = 0; y0 < settings.image_height; y0 += tile_size )
+    {
+        for( int x0 = 0; x0 < settings.image_width; x0 += tile_size )
+        {
+            tile_state_t tile;
+            tile.x0 = x0;
+            tile.y0 = y0;
+            tile.x1 = std::min( x0 + tile_size, settings.image_width );
+            tile.y1 = std::min( y0 + tile_size, settings.image_height );
+            tile.color.resize( ( tile.x1 - tile.x0 ) * ( tile.y1 - tile.y0 ) );
+            tile.footprint = path_footprint_t( grid );
+            tiles.push_back( std::move( tile ) );
+        }
+    }
+}
+
+bool incremental_renderer_t::move_sphere( size_t index, const point3_t &center )
+{
+    if( index >= scene->world.size() )
+        return false;
+
+    const auto sphere = std::dynamic_pointer_cast<sphere_t>( scene->world.object( index ) );
+    if( !sphere )
+        return false;
+
+    replace_object( index, std::make_shared<sphere_t>( center, sphere->radius(), sphere->material() ), true );
+    return true;
+}
+
+bool incremental_renderer_t::set_material( size_t index, std::shared_ptr<material_t> material )
+{
+    if( index >= scene->world.size() )
+        return false;
+
+    const auto sphere = std::dynamic_pointer_cast<sphere_t>( scene->world.object( index ) );
+    if( !sphere )
+        return false;
+
+    // Same geometry, so only the tiles that saw the object change
+    replace_object( index, std::make_shared<sphere_t>( sphere->center(), sphere->radius(), material ), false );
+    return true;
+}
+
+void incremental_renderer_t::replace_object( size_t index, std::shared_ptr<sphere_t> sphere, bool moved )
+{
+    const hittable_t *old_object = scene->world.object( index ).get();
+    const bool is_light = scene->lights.contains( old_object );
+    const aabb_t old_bounds = old_object->bounding_box();
+    const aabb_t new_bounds = sphere->bounding_box();
+
+    for( auto &tile : tiles )
+    {
+        const path_footprint_t &footprint = tile.footprint;
+        if( is_light || footprint.hit( old_object )
+            || ( moved && ( footprint.crosses( old_bounds ) || footprint.crosses( new_bounds ) ) ) )
+            tile.dirty = true;
+    }
+
+    if( is_light )
+    {
+        // Power as the scene builders compute it, the luminance of the front face's emission times the area
+        hit_record_t front;
+        front.front_face = true;
+        const double radius = sphere->radius();
+        const double power = dot( sphere->material()->emitted( front ), color_t{ 0.2126, 0.7152, 0.0722 } ) * 4.0 * pi
+                             * radius * radius;
+        scene->lights.replace( old_object, sphere, power );
+    }
+    scene->world.replace( index, std::move( sphere ) );
+}
+
+void incremental_renderer_t::render_tile( tile_state_t &tile )
+{
+    TRACE_SCOPE_ARG( "render_tile", tile.y0 * settings.image_width + tile.x0 );
+    PERF_TILE( "render_tile", tile.y0 * settings.image_width + tile.x0 );
+
+    tile.footprint.clear();
+    {
+        path_record_scope_t record( tile.footprint );
+
+        // Start from the same random state as a full render so the result matches one
+        for( int row = tile.y0; row < tile.y1; row++ )
+        {
+            for( int col = tile.x0; col < tile.x1; col++ )
+                jobs[row * settings.image_width + col].rng = scene->rng.clone();
+        }
+
+        render_rect( jobs, settings.image_width, tile.x0, tile.y0, tile.x1, tile.y1 );
+
+        const int width = tile.x1 - tile.x0;
+        for( int row = tile.y0; row < tile.y1; row++ )
+        {
+            for( int col = tile.x0; col < tile.x1; col++ )
+                tile.color[( row - tile.y0 ) * width + ( col - tile.x0 )]
+                    = jobs[row * settings.image_width + col].color;
+        }
+    }
+
+    tile.footprint.finish();
+    tile.dirty = false;
+}
+
+size_t incremental_renderer_t::update()
+{
+    TRACE_SCOPE( "incremental_update" );
+    PERF_PHASE( "incremental_update" );
+
+    std::vector<thread_pool_t::task_t> tasks;
+    for( auto &tile : tiles )
+    {
+        if( tile.dirty )
+            tasks.emplace_back( [this, &tile] { render_tile( tile ); } );
+    }
+
+    const size_t rendered = tasks.size();
+    pool.run( std::move( tasks ) );
+    return rendered;
+}
+
+image_t incremental_renderer_t::image() const
+{
+    auto pixel = image_t( settings.image_height, std::vector<color_t>( settings.image_width, color_t{} ) );
+    for( const auto &tile : tiles )
+    {
+        const int width = tile.x1 - tile.x0;
+        for( int row = tile.y0; row < tile.y1; row++ )
+        {
+            for( int col = tile.x0; col < tile.x1; col++ )
+                pixel[row][col] = tile.color[( row - tile.y0 ) * width + ( col - tile.x0 )];
+        }
+    }
+    return pixel;
+}
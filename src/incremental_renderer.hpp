@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "camera.hpp"
+#include "material.hpp"
+#include "path_footprint.hpp"
+#include "renderer.hpp"
+#include "scene.hpp"
+#include "sphere.hpp"
+#include "thread_pool.hpp"
+
+// Keeps the samples of every tile and the footprint of its paths: the objects they hit at any bounce and the grid
+// cells their segments and shadow rays crossed. After a material edit only the tiles whose paths hit the object are
+// rendered again, after a move also those whose segments or shadow rays cross its old or new bounds. Editing a
+// light changes the lighting everywhere and renders every tile. The result matches a full render of the edited scene.
+class incremental_renderer_t
+{
+public:
+    incremental_renderer_t( thread_pool_t &pool,
+                            std::shared_ptr<scene_t> scene,
+                            const render_settings_t &settings,
+                            int tile_size );
+
+    // Jobs point at the camera member
+    incremental_renderer_t( const incremental_renderer_t & ) = delete;
+    incremental_renderer_t &operator=( const incremental_renderer_t & ) = delete;
+
+    // Edits return false if the object does not exist or is not a sphere
+    bool move_sphere( size_t index, const point3_t &center );
+    bool set_material( size_t index, std::shared_ptr<material_t> material );
+
+    // Renders the tiles that are dirty, every tile the first time. Returns the number of tiles rendered.
+    size_t update();
+
+    size_t tile_count() const
+    {
+        return tiles.size();
+    }
+
+    // Summed samples per pixel, as render() produces them
+    image_t image() const;
+
+private:
+    struct tile_state_t
+    {
+        int x0, y0, x1, y1;
+        std::vector<color_t> color;
+        path_footprint_t footprint;
+        bool dirty{ true };
+    };
+
+    void replace_object( size_t index, std::shared_ptr<sphere_t> sphere, bool moved );
+    void render_tile( tile_state_t &tile );
+
+private:
+    thread_pool_t &pool;
+    std::shared_ptr<scene_t> scene;
+    render_settings_t settings;
+    camera_t cam;
+    footprint_grid_t grid;
+    std::vector<Job> jobs;
+    std::vector<tile_state_t> tiles;
+};
@@ -0,0 +1,161 @@
+#include "instance_set.hpp"
+#include "trace.hpp"
+
+instance_set_t::instance_set_t( size_t count, std::vector<std::shared_ptr<const hittable_t>> prototypes )
+    : prototypes( std::move( prototypes ) ),
+      instances( count ),
+      bounds( count )
+{
+    for( const auto &prototype : this->prototypes )
+        prototype_bounds.push_back( prototype->bounding_box() );
+}
+
+bool instance_set_t::set( size_t index, uint32_t prototype, const transform_t &object_to_world )
+{
+    if( prototype >= prototypes.size() )
+        return false;
+
+    const transform_t world_to_object = object_to_world.inverse();
+
+    instance_t &instance = instances[index];
+    for( int i = 0; i < 3; i++ )
+    {
+        for( int j = 0; j < 4; j++ )
+            instance.world_to_object[i][j] = static_cast<float>( world_to_object.m[i][j] );
+    }
+    instance.prototype = prototype;
+
+    // The transformed corners of the prototype's box bound the instance
+    const aabb_t &box = prototype_bounds[instance.prototype];
+    aabb_t world;
+    for( int corner = 0; corner < 8; corner++ )
+    {
+        world.expand( object_to_world.point( point3_t{ corner & 1 ? box.max.x : box.min.x,
+                                                       corner & 2 ? box.max.y : box.min.y,
+                                                       corner & 4 ? box.max.z : box.min.z } ) );
+    }
+    bounds[index] = world;
+    return true;
+}
+
+void instance_set_t::build( int leaf_size )
+{
+    TRACE_SCOPE( "build_bvh" );
+
+    bvh.build( instances.size(), leaf_size, [this]( uint32_t i ) -> const aabb_t & { return bounds[i]; } );
+
+    // Store the instances in leaf order so leaves address them directly and the order table can go
+    std::vector<instance_t> ordered( instances.size() );
+    const auto &order = bvh.order();
+    const int64_t n = static_cast<int64_t>( instances.size() );
+
+#pragma omp parallel for schedule( static )
+    for( int64_t slot = 0; slot < n; slot++ )
+        ordered[slot] = instances[order[slot]];
+
+    instances.swap( ordered );
+    bvh.release_order();
+    bounds = std::vector<aabb_t>();
+}
+
+ray_t instance_set_t::to_object( const instance_t &instance, const ray_t &r ) const
+{
+    const auto &m = instance.world_to_object;
+    const point3_t o = r.origin();
+    const vec3_t d = r.direction();
+
+    // The direction is not normalized, so t means the same in both spaces
+    return ray_t( point3_t{ m[0][0] * o.x + m[0][1] * o.y + m[0][2] * o.z + m[0][3],
+                            m[1][0] * o.x + m[1][1] * o.y + m[1][2] * o.z + m[1][3],
+                            m[2][0] * o.x + m[2][1] * o.y + m[2][2] * o.z + m[2][3] },
+                  vec3_t{ m[0][0] * d.x + m[0][1] * d.y + m[0][2] * d.z,
+                          m[1][0] * d.x + m[1][1] * d.y + m[1][2] * d.z,
+                          m[2][0] * d.x + m[2][1] * d.y + m[2][2] * d.z },
+                  r.spread() );
+}
+
+bool instance_set_t::hit_instance(
+    uint32_t slot, const ray_t &r, double t_min, double t_max, hit_record_t &rec ) const
+{
+    const instance_t &instance = instances[slot];
+    if( !prototypes[instance.prototype]->hit( to_object( instance, r ), t_min, t_max, rec ) )
+        return false;
+
+    // Normals map with the transpose of the inverse, which keeps their side relative to the ray
+    const auto &m = instance.world_to_object;
+    const vec3_t n = rec.normal;
+    rec.normal = unit_vector( vec3_t{ m[0][0] * n.x + m[1][0] * n.y + m[2][0] * n.z,
+                                      m[0][1] * n.x + m[1][1] * n.y + m[2][1] * n.z,
+                                      m[0][2] * n.x + m[1][2] * n.y + m[2][2] * n.z } );
+    rec.p = r.at( rec.t );
+    rec.object = this;
+    return true;
+}
+
+bool instance_set_t::hit( const ray_t &r, double t_min, double t_max, hit_record_t &rec ) const
+{
+    return bvh.traverse( r,
+                         t_min,
+                         t_max,
+                         [&]( uint32_t first, uint32_t slot_count, double &closest_so_far )
+                         {
+                             bool hit_anything = false;
+                             for( uint32_t slot = first; slot < first + slot_count; slot++ )
+                             {
+                                 if( hit_instance( slot, r, t_min, closest_so_far, rec ) )
+                                 {
+                                     closest_so_far = rec.t;
+                                     hit_anything = true;
+                                 }
+                             }
+                             return hit_anything;
+                         } );
+}
+
+bool instance_set_t::hit_any( const ray_t &r, double t_min, double t_max ) const
+{
+    return bvh.traverse_any( r,
+                             t_min,
+                             t_max,
+                             [&]( uint32_t first, uint32_t slot_count )
+                             {
+                                 for( uint32_t slot = first; slot < first + slot_count; slot++ )
+                                 {
+                                     const instance_t &instance = instances[slot];
+                                     if( prototypes[instance.prototype]->hit_any(
+                                             to_object( instance, r ), t_min, t_max ) )
+                                         return true;
+                                 }
+                                 return false;
+                             } );
+}
+
+void instance_set_t::hit_packet( ray_packet_t &packet, double t_min ) const
+{
+    // The top level is traversed as a packet, inside an instance the rays go on one by one
+    hit_record_t rec;
+    bvh.traverse_packet( packet,
+                         t_min,
+                         [&]( uint32_t first, uint32_t slot_count )
+                         {
+                             packet.for_each_active(
+                                 [&]( int i )
+                                 {
+                                     for( uint32_t slot = first; slot < first + slot_count; slot++ )
+                                     {
+                                         if( hit_instance( slot, packet.ray( i ), t_min, packet.t_max( i ), rec ) )
+                                             packet.set_hit( i, rec );
+                                     }
+                                 } );
+                         } );
+}
+
+aabb_t instance_set_t::bounding_box() const
+{
+    return bvh.bounds();
+}
+
+size_t instance_set_t::memory_bytes() const
+{
+    return instances.capacity() * sizeof( instance_t ) + bounds.capacity() * sizeof( aabb_t ) + bvh.memory_bytes();
+}
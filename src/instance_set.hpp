@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hittable.hpp"
+#include "bvh.hpp"
+#include "transform.hpp"
+
+// Many copies of a few prototypes, each placed by its own affine transform. The set indexes the instances with a
+// bvh_t over their world bounds and every prototype keeps its own index in object space, so the geometry is stored
+// once per prototype and an instance costs a transform and an index. Rays are transformed into the prototype's
+// space, hits come back with world space points and normals and report the set as their object; prototypes are
+// meant to be plain geometry, their texture mappings and lights are not carried over. Fill every slot with set(),
+// then call build().
+class instance_set_t : public hittable_t
+{
+public:
+    // Prototypes should have built their own index already
+    instance_set_t( size_t count, std::vector<std::shared_ptr<const hittable_t>> prototypes );
+
+    // Safe to call concurrently for different indices. Returns false and leaves the slot as it was when prototype is
+    // not an index into the prototypes.
+    bool set( size_t index, uint32_t prototype, const transform_t &object_to_world );
+
+    // Builds the hierarchy and reorders the instances to match its leaves
+    void build( int leaf_size );
+
+    virtual bool hit( const ray_t &r, double t_min, double t_max, hit_record_t &rec ) const override;
+    virtual bool hit_any( const ray_t &r, double t_min, double t_max ) const override;
+    virtual void hit_packet( ray_packet_t &packet, double t_min ) const override;
+    virtual aabb_t bounding_box() const override;
+
+    size_t size() const
+    {
+        return instances.size();
+    }
+
+    size_t prototype_count() const
+    {
+        return prototypes.size();
+    }
+
+    // Instances and their hierarchy, not the prototypes
+    size_t memory_bytes() const;
+
+private:
+    struct instance_t
+    {
+        float world_to_object[3][4];
+        uint32_t prototype;
+    };
+
+    ray_t to_object( const instance_t &instance, const ray_t &r ) const;
+    bool hit_instance( uint32_t slot, const ray_t &r, double t_min, double t_max, hit_record_t &rec ) const;
+
+private:
+    std::vector<std::shared_ptr<const hittable_t>> prototypes;
+    std::vector<aabb_t> prototype_bounds;
+    std::vector<instance_t> instances;
+    std::vector<aabb_t> bounds; // world bounds of the instances, only until build()
+
+    bvh_t bvh;
+};
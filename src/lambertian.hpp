@@ -1,12 +1,22 @@
 #pragma once
 
+#include <memory>
+
 #include "material.hpp"
+#include "texture.hpp"
 
 class lambertian_t : public material_t
 {
 public:
     lambertian_t( const color_t &a ) : albedo( a ) { }
 
+    // diffuse() keeps returning the constant albedo, which multiplies the texture
+    lambertian_t( std::shared_ptr<texture_t> t, const color_t &a = color_t{ 1.0, 1.0, 1.0 } )
+        : albedo( a ),
+          texture( std::move( t ) )
+    {
+    }
+
     virtual color_t diffuse() const override
     {
         return albedo;
@@ -24,11 +34,46 @@ public:
         if( near_zero( scatter_direction ) )
             scatter_direction = rec.normal;
 
-        scattered = ray_t( rec.p, scatter_direction );
-        attenuation = albedo;
+        scattered = ray_t( rec.p, scatter_direction, r_in.spread() );
+        attenuation = albedo_at( rec );
         return true;
     }
 
+    virtual bool is_specular() const override
+    {
+        return false;
+    }
+
+    virtual color_t eval( const hit_record_t &rec, const vec3_t &direction ) const override
+    {
+        return albedo_at( rec ) * pdf( rec, direction );
+    }
+
+    // scatter() adds a random unit vector to the normal, which is cosine weighted
+    virtual double pdf( const hit_record_t &rec, const vec3_t &direction ) const override
+    {
+        const double cosine = dot( rec.normal, unit_vector( direction ) );
+        return cosine > 0.0 ? cosine / pi : 0.0;
+    }
+
+    virtual bool same_as( const material_t &other ) const override
+    {
+        const auto *o = dynamic_cast<const lambertian_t *>( &other );
+        return o && o->albedo == albedo && o->texture == texture;
+    }
+
+    virtual size_t hash() const override
+    {
+        return hash_values( { 1.0, albedo.x, albedo.y, albedo.z } ) ^ std::hash<const texture_t *>()( texture.get() );
+    }
+
+private:
+    color_t albedo_at( const hit_record_t &rec ) const
+    {
+        return texture ? albedo * texture->value( rec ) : albedo;
+    }
+
 private:
     color_t albedo;
+    std::shared_ptr<texture_t> texture; // nullptr for a constant albedo
 };
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "hittable.hpp"
+#include "utils.hpp"
+
+// Emissive objects of a scene (they are in the world as well), picked with probability proportional to their power
+class light_list_t
+{
+public:
+    void add( std::shared_ptr<hittable_t> object, double power )
+    {
+        lights.push_back( light_t{ object, power, 0.0 } );
+        update_probabilities();
+    }
+
+    bool empty() const
+    {
+        return lights.empty();
+    }
+
+    size_t size() const
+    {
+        return lights.size();
+    }
+
+    bool contains( const hittable_t *object ) const
+    {
+        return std::any_of(
+            lights.begin(), lights.end(), [object]( const light_t &light ) { return light.object.get() == object; } );
+    }
+
+    // Swaps an edited light in with its new power
+    void replace( const hittable_t *object, std::shared_ptr<hittable_t> replacement, double power )
+    {
+        for( auto &light : lights )
+        {
+            if( light.object.get() == object )
+            {
+                light.object = replacement;
+                light.power = power;
+            }
+        }
+        update_probabilities();
+    }
+
+    // Picks a light, probability is set to the chance of picking it
+    const hittable_t *sample( random_number_generator_t &rng, double &probability ) const
+    {
+        const double u = rng.random_double();
+        double cumulative = 0.0;
+        for( const auto &light : lights )
+        {
+            cumulative += light.probability;
+            if( u < cumulative )
+            {
+                probability = light.probability;
+                return light.object.get();
+            }
+        }
+
+        probability = lights.back().probability;
+        return lights.back().object.get();
+    }
+
+    // Solid angle density with which sample() followed by random_direction() produces direction, 0 if object is
+    // not a light
+    double pdf_value( const hittable_t *object, const point3_t &origin, const vec3_t &direction ) const
+    {
+        for( const auto &light : lights )
+        {
+            if( light.object.get() == object )
+                return light.probability * object->pdf_value( origin, direction );
+        }
+        return 0.0;
+    }
+
+private:
+    void update_probabilities()
+    {
+        double total = 0.0;
+        for( const auto &light : lights )
+            total += light.power;
+        for( auto &light : lights )
+            light.probability = total > 0.0 ? light.power / total : 1.0 / lights.size();
+    }
+
+private:
+    struct light_t
+    {
+        std::shared_ptr<hittable_t> object;
+        double power;
+        double probability;
+    };
+
+    std::vector<light_t> lights;
+};
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -7,275 +8,494 @@
 #include <iomanip>
 #include <functional>
 #include <thread>
-#include <execution>
+#include <sstream>
 
 #include "vec3.hpp"
-#include "hittable_list.hpp"
+#include "autotune.hpp"
+#include "camera.hpp"
+#include "dielectric.hpp"
+#include "diffuse_light.hpp"
+#include "incremental_renderer.hpp"
 #include "lambertian.hpp"
 #include "metal.hpp"
-#include "dielectric.hpp"
-#include "sphere.hpp"
-#include "camera.hpp"
+#include "perf_counters.hpp"
+#include "renderer.hpp"
+#include "scene.hpp"
+#include "server.hpp"
+#include "thread_pool.hpp"
+#include "topology.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
-[[nodiscard]] hittable_list_t simple_scene()
+int serve( int argc, char **argv )
 {
-    hittable_list_t world;
-
-    const auto ground_material = std::make_shared<lambertian_t>( color_t{ 0.5, 0.5, 0.5 } );
-    world.add( std::make_shared<sphere_t>( point3_t{ 0.0, -1000.0, 0.0 }, 1000, ground_material ) );
-
-    const auto material1 = std::make_shared<dielectric_t>( 1.5 );
-    world.add( std::make_shared<sphere_t>( point3_t{ 0, 1, 0 }, 1.0, material1 ) );
-
-    const auto material2 = std::make_shared<lambertian_t>( color_t{ 0.4, 0.2, 0.1 } );
-    world.add( std::make_shared<sphere_t>( point3_t{ -4, 1, 0 }, 1.0, material2 ) );
+    server_settings_t settings;
 
-    const auto material3 = std::make_shared<metal_t>( color_t{ 0.7, 0.6, 0.5 }, 0.0 );
-    world.add( std::make_shared<sphere_t>( point3_t{ 4, 1, 0 }, 1.0, material3 ) );
+    for( int i = 2; i < argc; i++ )
+    {
+        const std::string arg = argv[i];
+        if( arg == "--threads" && i + 1 < argc )
+            settings.thread_count = std::stoi( argv[++i] );
+        else if( arg == "--cache" && i + 1 < argc )
+            settings.cache_capacity = std::stoi( argv[++i] );
+        else if( arg == "--socket" && i + 1 < argc )
+            settings.socket_path = argv[++i];
+        else if( arg == "--trace" && i + 1 < argc )
+            settings.trace_path = argv[++i];
+        else if( arg == "--perf-counters" )
+            settings.perf_counters = true;
+        else if( arg == "--pin" && i + 1 < argc && parse_pin_policy( argv[i + 1], settings.pin_policy ) )
+            i++;
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " serve [--threads N] [--cache N] [--socket PATH] [--trace FILE]"
+                      << " [--perf-counters] [--pin none|compact|scatter]\n";
+            return EXIT_FAILURE;
+        }
+    }
 
-    return world;
+    return run_server( settings );
 }
 
-[[nodiscard]] hittable_list_t random_scene( random_number_generator_t &rng )
+std::vector<double> parse_numbers( const std::string &text )
 {
-    hittable_list_t world;
-
-    const auto ground_material = std::make_shared<lambertian_t>( color_t{ 0.5, 0.5, 0.5 } );
-    world.add( std::make_shared<sphere_t>( point3_t{ 0.0, -1000.0, 0.0 }, 1000, ground_material ) );
+    std::vector<double> numbers;
+    std::istringstream in( text );
+    std::string number;
+    while( std::getline( in, number, ',' ) )
+        numbers.push_back( std::stod( number ) );
+    return numbers;
+}
 
-    const auto world_center = point3_t{ 4, 0.2, 0 };
-    const auto radius = 0.2;
+// lambertian:r,g,b, metal:r,g,b,fuzz, dielectric:index_of_refraction or light:r,g,b
+std::shared_ptr<material_t> parse_material( const std::string &text )
+{
+    const auto colon = text.find( ':' );
+    if( colon == std::string::npos )
+        return nullptr;
+
+    const std::string kind = text.substr( 0, colon );
+    const std::vector<double> v = parse_numbers( text.substr( colon + 1 ) );
+
+    if( kind == "lambertian" && v.size() == 3 )
+        return std::make_shared<lambertian_t>( color_t{ v[0], v[1], v[2] } );
+    if( kind == "metal" && v.size() == 4 )
+        return std::make_shared<metal_t>( color_t{ v[0], v[1], v[2] }, v[3] );
+    if( kind == "dielectric" && v.size() == 1 )
+        return std::make_shared<dielectric_t>( v[0] );
+    if( kind == "light" && v.size() == 3 )
+        return std::make_shared<diffuse_light_t>( color_t{ v[0], v[1], v[2] } );
+    return nullptr;
+}
 
-    for( int a = -11; a < 11; a++ )
+// "move INDEX x,y,z" or "material INDEX MATERIAL"
+bool apply_edit( incremental_renderer_t &renderer, const std::string &edit )
+{
+    std::istringstream in( edit );
+    std::string command;
+    size_t index = 0;
+    std::string argument;
+    in >> command >> index >> argument;
+    if( in.fail() )
+        return false;
+
+    try
     {
-        for( int b = -11; b < 11; b++ )
+        if( command == "move" )
         {
-            const point3_t sphere_center{ a + 0.9 * rng.random_double(), 0.2, b + 0.9 * rng.random_double() };
-
-            if( length( sphere_center - world_center ) > 0.9 )
-            {
-                const auto choose_mat = rng.random_double();
-                std::shared_ptr<material_t> material;
-                if( choose_mat < 0.8 )
-                {
-                    // diffuse
-                    const auto albedo = rng.random_vec3();
-                    material = std::make_shared<lambertian_t>( albedo );
-                }
-                else if( choose_mat < 0.95 )
-                {
-                    // metal_t
-                    const auto albedo = rng.random_vec3_range( 0.5, 1 );
-                    const auto fuzz = rng.random_range( 0, 0.5 );
-                    material = std::make_shared<metal_t>( albedo, fuzz );
-                }
-                else
-                {
-                    // glass
-                    material = std::make_shared<dielectric_t>( 1.5 );
-                }
-                world.add( std::make_shared<sphere_t>( sphere_center, radius, material ) );
-            }
+            const std::vector<double> v = parse_numbers( argument );
+            return v.size() == 3 && renderer.move_sphere( index, point3_t{ v[0], v[1], v[2] } );
         }
+        if( command == "material" )
+        {
+            const auto material = parse_material( argument );
+            return material && renderer.set_material( index, material );
+        }
+    }
+    catch( const std::exception & )
+    {
     }
 
-    const auto material1 = std::make_shared<dielectric_t>( 1.5 );
-    world.add( std::make_shared<sphere_t>( point3_t{ 0, 1, 0 }, 1.0, material1 ) );
+    return false;
+}
 
-    const auto material2 = std::make_shared<lambertian_t>( color_t{ 0.4, 0.2, 0.1 } );
-    world.add( std::make_shared<sphere_t>( point3_t{ -4, 1, 0 }, 1.0, material2 ) );
+double milliseconds_since( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
 
-    const auto material3 = std::make_shared<metal_t>( color_t{ 0.7, 0.6, 0.5 }, 0.0 );
-    world.add( std::make_shared<sphere_t>( point3_t{ 4, 1, 0 }, 1.0, material3 ) );
+void print_texture_stats( const scene_t &scene )
+{
+    if( !scene.textures )
+        return;
+
+    const texture_cache_t::stats_t stats = scene.textures->stats();
+    std::cerr << "Texture cache: " << stats.lookups << " tile lookups, hit rate " << stats.hit_rate() * 100.0 << "%, "
+              << stats.misses << " tiles loaded, " << stats.evictions << " evicted, peak "
+              << stats.peak_bytes / ( 1024.0 * 1024.0 ) << " of " << stats.capacity_bytes / ( 1024.0 * 1024.0 )
+              << " MB\n";
+}
+
+void write_trace( const std::string &path )
+{
+    if( path.empty() || !trace_start() )
+        return;
 
-    return world;
+    if( trace_write( path ) )
+        std::cerr << "Trace written to " << path << '\n';
+    else
+        std::cerr << "Cannot write trace to " << path << '\n';
 }
 
-[[nodiscard]] color_t
-ray_color( int col, int row, const ray_t &r, const hittable_t &world, int depth, random_number_generator_t &rng )
+// One scene per NUMA node, node 0 being the primary one. The others are built by threads restricted to their node,
+// so the memory they allocate is local to it.
+std::vector<std::shared_ptr<const scene_t>>
+build_scene_replicas( const std::string &name, int leaf_size, const std::shared_ptr<scene_t> &primary )
 {
-    if( depth <= 0 )
-        return color_t{ 1.0, 1.0, 1.0 };
+    const cpu_topology_t &topology = cpu_topology_t::machine();
+    std::vector<std::shared_ptr<const scene_t>> replicas( topology.node_count() );
+    replicas[0] = primary;
 
-    hit_record_t rec;
-    if( world.hit( r, 0.001, infinity, rec ) )
+    std::vector<std::thread> builders;
+    for( int node = 1; node < topology.node_count(); node++ )
     {
-        ray_t scattered;
-        color_t attenuation;
-        if( rec.material->scatter( r, rec, rng, attenuation, scattered ) )
-        {
-            auto recursed_color = ray_color( col, row, scattered, world, depth - 1, rng );
-            // std::cerr << "> Scatter " << col << ' ' << row << " dir=" << r.direction() << " attenuation=" << attenuation
-            //           << " recursed_color=" << recursed_color << " out=" << ( attenuation * recursed_color ) << '\n';
-            return attenuation * recursed_color;
-        }
-
-        // std::cerr << "> Diffuse " << col << ' ' << row << " = " << rec.material->diffuse() << '\n';
-        return rec.material->diffuse();
+        builders.emplace_back(
+            [&, node]
+            {
+                pin_current_thread( topology.node_cpus( node ) );
+                replicas[node] = make_scene( name, leaf_size );
+            } );
     }
+    for( auto &builder : builders )
+        builder.join();
 
-    const vec3_t unit_direction = unit_vector( r.direction() );
-    const auto t = 0.5 * ( unit_direction.y + 1.0 );
-    constexpr color_t white = color_t{ 1.0, 1.0, 1.0 };
-    constexpr color_t blue = color_t{ 0.5, 0.7, 1.0 };
-    auto sky = white * ( 1.0 - t ) + blue * t;
-
-    // std::cerr << "> Sky " << col << ' ' << row << " = " << sky << '\n';
-
-    return sky;
+    return replicas;
 }
 
-struct Job
-{
-    color_t color;
-    random_number_generator_t rng;
-    int row;
-    int col;
-    const hittable_list_t *world;
-    const camera_t *cam;
-    int image_width;
-    int image_height;
-    int samples_per_pixel_x;
-    int samples_per_pixel_y;
-    int max_depth;
-};
-
-[[nodiscard]] color_t render_job( Job &job )
+void print_node_report( const std::vector<node_report_t> &nodes )
 {
-    int samples_per_pixel = job.samples_per_pixel_x * job.samples_per_pixel_y;
+    const cpu_topology_t &topology = cpu_topology_t::machine();
+    uint64_t total_bands = 0;
+    for( const auto &node : nodes )
+        total_bands += node.bands;
 
-    color_t color = color_t{ 0.0, 0.0, 0.0 };
-
-    for( int sample_y = 0; sample_y < job.samples_per_pixel_y; sample_y++ )
+    for( size_t n = 0; n < nodes.size(); n++ )
     {
-        double y = double( sample_y ) / job.samples_per_pixel_y - 0.5;
-        double v = ( job.row + y ) / ( job.image_height - 1 );
-
-        for( int sample_x = 0; sample_x < job.samples_per_pixel_x; sample_x++ )
-        {
-            // std::cerr << "Job " << job.col << ' ' << job.row << ", sample " << sample_x << ' ' << sample_y << '\n';
-
-            double x = double( sample_x ) / job.samples_per_pixel_x - 0.5;
-            double u = ( job.col + x ) / ( job.image_width - 1 );
-            const ray_t r = job.cam->get_ray( job.rng, u, v );
-            color += ray_color( job.col, job.row, r, *job.world, job.max_depth, job.rng );
-        }
+        const node_report_t &node = nodes[n];
+        std::cerr << "Node " << n << ": " << node.threads << " threads on " << topology.node_cpus( int( n ) ).size()
+                  << " CPUs, " << node.bands << " bands (" << 100.0 * node.bands / std::max<uint64_t>( total_bands, 1 )
+                  << "%), " << node.rays / 1e6 << " Mrays, " << node.busy_ms << " ms busy";
+        if( node.busy_ms > 0.0 )
+            std::cerr << ", " << node.rays / ( node.busy_ms * 1e3 ) << " Mrays/s per thread";
+        std::cerr << '\n';
     }
-
-    return color;
 }
 
-void render( int image_width, int image_height, std::vector<Job> &jobs, std::vector<std::vector<color_t>> &pixel )
+void print_usage( const char *program )
 {
-    int job_count = image_width * image_height;
-    int job_index = 0;
-
-    // #pragma omp parallel for shared( remaining_jobs, remaining_lines )
-    std::for_each( std::execution::seq,
-                   jobs.begin(),
-                   jobs.end(),
-                   [&pixel, &job_index, job_count, image_width]( Job &job )
-                   {
-                       if( job_index % image_width == 0 )
-                       {
-                           int remaining_lines = ( job_count - job_index ) / image_width;
-                           std::cerr << "Lines remaining: " << remaining_lines << "    \r";
-                       }
-                       pixel[job.row][job.col] = render_job( job );
-                       job_index++;
-                   } );
-    std::cerr << "Lines remaining: 0    \n";
+    std::cerr << "Usage: " << program << " [SCENE] [--deadline-ms MS] [--no-light-sampling] [--trace FILE]"
+              << " [--perf-counters]\n"
+              << "       " << program << " [SCENE] [--pin none|compact|scatter] [--replicate-scene] [--first-touch]\n"
+              << "       " << program << " [SCENE] [--autotune] [--tune-cache FILE] [--threads N] [--tile-rows N]"
+              << " [--leaf N] [--packet-width N]\n"
+              << "       " << program << " [SCENE] --edit \"move INDEX x,y,z\" --edit \"material INDEX MATERIAL\" ..."
+              << " [--check-edits]\n"
+              << "       " << program << " serve [--threads N] [--cache N] [--socket PATH] [--trace FILE]"
+              << " [--perf-counters] [--pin none|compact|scatter]\n"
+              << "Scenes: simple, random, cornell, procedural[:count=N,extent=E,seed=S,budget_mb=M,leaf=L],\n"
+              << "        forest[:count=N,prototypes=P,seed=S,leaf=L],\n"
+              << "        textured:texture=FILE.ppm[,texture=...,count=N,cache_mb=M,tile=T]\n";
 }
 
 int main( int argc, char **argv )
 {
+    const auto start = std::chrono::steady_clock::now();
+
+    if( argc > 1 && std::string( argv[1] ) == "serve" )
+        return serve( argc, argv );
+
+    std::string scene_name = "random";
+    double deadline_ms = 0.0;
+    std::string trace_path;
+    bool sample_lights = true;
+    bool perf_counters = false;
+    pin_policy_t pin_policy = pin_policy_t::none;
+    bool replicate_scene = false;
+    bool first_touch = false;
+    bool tune = false;
+    std::string tune_cache_path = default_tune_cache_path();
+    unsigned thread_count = 0; // 0 for the tuned or default value of these four
+    int tile_rows = 0;
+    int leaf_size = 0;
+    int packet_width = 0;
+    std::vector<std::string> edits;
+    bool check_edits = false;
+
+    for( int i = 1; i < argc; i++ )
+    {
+        const std::string arg = argv[i];
+        if( arg == "--deadline-ms" && i + 1 < argc )
+            deadline_ms = std::stod( argv[++i] );
+        else if( arg == "--trace" && i + 1 < argc )
+            trace_path = argv[++i];
+        else if( arg == "--no-light-sampling" )
+            sample_lights = false;
+        else if( arg == "--perf-counters" )
+            perf_counters = true;
+        else if( arg == "--edit" && i + 1 < argc )
+            edits.push_back( argv[++i] );
+        else if( arg == "--check-edits" )
+            check_edits = true;
+        else if( arg == "--pin" && i + 1 < argc && parse_pin_policy( argv[i + 1], pin_policy ) )
+            i++;
+        else if( arg == "--replicate-scene" )
+            replicate_scene = true;
+        else if( arg == "--first-touch" )
+            first_touch = true;
+        else if( arg == "--autotune" )
+            tune = true;
+        else if( arg == "--tune-cache" && i + 1 < argc )
+            tune_cache_path = argv[++i];
+        else if( arg == "--threads" && i + 1 < argc )
+            thread_count = std::stoi( argv[++i] );
+        else if( arg == "--tile-rows" && i + 1 < argc )
+            tile_rows = std::stoi( argv[++i] );
+        else if( arg == "--leaf" && i + 1 < argc )
+            leaf_size = std::stoi( argv[++i] );
+        else if( arg == "--packet-width" && i + 1 < argc )
+            packet_width = std::stoi( argv[++i] );
+        else if( !arg.empty() && arg[0] != '-' )
+            scene_name = arg;
+        else
+        {
+            print_usage( argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    if( !trace_path.empty() )
+    {
+        if( trace_start() )
+            trace_set_thread_name( "main" );
+        else
+            std::cerr << "Built without RAYTRACER_TRACE, --trace is ignored\n";
+    }
+
+    std::string perf_error;
+    if( perf_counters && !perf_counters_start( rays_traced_by_thread, perf_error ) )
+        std::cerr << "Performance counters unavailable: " << perf_error << '\n';
+
     // Image
     constexpr double aspect_ratio = 16.0 / 10.0;
     constexpr int image_width = 192;
     constexpr int image_height = static_cast<int>( image_width / aspect_ratio );
     constexpr int samples_per_pixel_x = 16;
     constexpr int samples_per_pixel_y = 16;
-    constexpr int sample_count = samples_per_pixel_x * samples_per_pixel_y;
     constexpr int job_count = image_height * image_width;
     constexpr int max_depth = 50;
 
+    render_settings_t settings;
+    settings.image_width = image_width;
+    settings.image_height = image_height;
+    settings.samples_per_pixel_x = samples_per_pixel_x;
+    settings.samples_per_pixel_y = samples_per_pixel_y;
+    settings.max_depth = max_depth;
+    settings.sample_lights = sample_lights;
+
     std::cerr << "Rendering " << image_width << 'x' << image_height << " image with " << samples_per_pixel_x << 'x'
               << samples_per_pixel_y << " samples per pixel" << '\n';
 
-    random_number_generator_t rng;
-    rng.random_double();
+    const cpu_topology_t &topology = cpu_topology_t::machine();
+    const bool numa_report = pin_policy != pin_policy_t::none || replicate_scene || first_touch;
+    if( numa_report )
+        std::cerr << topology.cpus().size() << " CPUs on " << topology.node_count() << " NUMA nodes, workers pinned "
+                  << pin_policy_name( pin_policy ) << '\n';
+
+    // The primary scene is built on node 0, where the main thread stays
+    if( replicate_scene )
+        pin_current_thread( topology.node_cpus( 0 ) );
 
     // World
-    hittable_list_t world;
-    if( argc > 1 && std::string( argv[1] ) == "simple" )
+    std::cerr << "Loading " << scene_name << " scene" << '\n';
+    // Tuning starts from the default leaf sizes, the one given on the command line is applied afterwards
+    int scene_leaf_size = tune ? 0 : leaf_size;
+    std::shared_ptr<scene_t> scene = make_scene( scene_name, scene_leaf_size );
+    if( !scene )
     {
-        std::cerr << "Loading simple scene" << '\n';
-        world = simple_scene();
+        std::cerr << "Unknown scene " << scene_name << '\n';
+        print_usage( argv[0] );
+        return EXIT_FAILURE;
     }
-    else
+
+    tuned_settings_t tuned;
+    if( tune )
     {
-        std::cerr << "Loading random scene" << '\n';
-        world = random_scene( rng );
+        const std::string key = scene_fingerprint( scene_name, *scene, settings ) + ' ' + cpu_fingerprint();
+        if( load_tuned_settings( tune_cache_path, key, tuned ) )
+        {
+            std::cerr << "Autotune: using settings cached in " << tune_cache_path << '\n';
+        }
+        else
+        {
+            const auto tune_start = std::chrono::steady_clock::now();
+            tuned = autotune( scene_name, scene, settings, 100.0, std::cerr );
+            scene_leaf_size = tuned.leaf_size;
+            std::cerr << "Autotune: finished in " << milliseconds_since( tune_start ) << " ms";
+            if( store_tuned_settings( tune_cache_path, key, tuned ) )
+                std::cerr << ", cached in " << tune_cache_path << '\n';
+            else
+                std::cerr << ", cannot write " << tune_cache_path << '\n';
+        }
+        std::cerr << "Autotune: leaf " << tuned.leaf_size << ", " << tuned.thread_count << " threads, "
+                  << tuned.tile_rows << " row tiles, " << tuned.packet_width << 'x' << tuned.packet_width
+                  << " packets, " << tuned.rays_per_second / 1e6 << " Mrays/s\n";
     }
 
-    // camera_t
-    const point3_t lookfrom{ 13.0, 2.0, 3.0 };
-    const point3_t lookat{ 0.0, 0.0, 0.0 };
-    const vec3_t vup{ 0.0, 1.0, 0.0 };
-    const double vfov = 20.0; // vertical field-of-view in degrees
-    const auto dist_to_focus = 10.0;
-    const auto aperture = 0.1;
-
-    camera_t cam{ lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus };
+    // The command line overrides what was tuned
+    thread_count = thread_count > 0 ? thread_count : tuned.thread_count;
+    settings.tile_rows = tile_rows > 0 ? tile_rows : tuned.tile_rows;
+    settings.packet_width = packet_width > 0 ? packet_width : tuned.packet_width;
+    leaf_size = leaf_size > 0 ? leaf_size : tuned.leaf_size;
+    if( leaf_size != scene_leaf_size )
+        scene = make_scene( scene_name, leaf_size );
+
+    std::cerr << "Scene has " << scene->primitive_count << " primitives, built in " << scene->build_ms << " ms (index "
+              << scene->index_ms << " ms)";
+    if( scene->memory_bytes > 0 )
+        std::cerr << ", " << scene->memory_bytes / ( 1024.0 * 1024.0 ) << " MB, "
+                  << double( scene->memory_bytes ) / scene->primitive_count << " bytes per primitive";
+    if( !scene->description.empty() )
+        std::cerr << ", " << scene->description;
+    if( scene->materials.requested() > 0 )
+        std::cerr << ", " << scene->materials.unique() << " unique of " << scene->materials.requested() << " materials";
+    std::cerr << '\n';
+
+    numa_placement_t placement;
+    if( replicate_scene )
+    {
+        const auto replicate_start = std::chrono::steady_clock::now();
+        placement.replicas = build_scene_replicas( scene_name, leaf_size, scene );
+        std::cerr << "Scene replicated on " << placement.replicas.size() << " nodes in "
+                  << milliseconds_since( replicate_start ) << " ms\n";
+    }
 
-    // Render
+    thread_pool_t pool( thread_count, pin_policy );
 
-    std::vector<Job> jobs;
-    jobs.reserve( job_count );
-    
-    for( int row = 0; row < image_height; row++ )
+    if( !edits.empty() )
     {
-        // std::cerr << "Creating jobs for line: " << row << "    \r";
+        // Render once, then apply every edit and re-render only the tiles it affects
+        constexpr int tile_size = 16;
+        incremental_renderer_t renderer( pool, scene, settings, tile_size );
 
-        for( int col = 0; col < image_width; col++ )
+        auto render_start = std::chrono::steady_clock::now();
+        renderer.update();
+        std::cerr << "Rendered " << renderer.tile_count() << " tiles in " << milliseconds_since( render_start )
+                  << " ms\n";
+
+        for( const auto &edit : edits )
         {
-            Job job;
-
-            job.rng = rng.clone();
-            job.row = row;
-            job.col = col;
-            job.world = &world;
-            job.cam = &cam;
-            job.image_width = image_width;
-            job.image_height = image_height;
-            job.samples_per_pixel_x = samples_per_pixel_x;
-            job.samples_per_pixel_y = samples_per_pixel_y;
-            job.max_depth = max_depth;
-
-            jobs.push_back( job );
+            if( !apply_edit( renderer, edit ) )
+            {
+                std::cerr << "Invalid edit: " << edit << '\n';
+                print_usage( argv[0] );
+                return EXIT_FAILURE;
+            }
+
+            render_start = std::chrono::steady_clock::now();
+            const size_t rendered = renderer.update();
+            std::cerr << "Edit \"" << edit << "\": re-rendered " << rendered << " of " << renderer.tile_count()
+                      << " tiles in " << milliseconds_since( render_start ) << " ms\n";
+        }
+
+        const image_t edited = renderer.image();
+        size_t mismatches = 0;
+        if( check_edits )
+        {
+            // Render the edited scene from scratch, the incremental result has to match it exactly
+            const camera_t cam{ scene->camera, aspect_ratio, image_height };
+            std::vector<Job> jobs = create_jobs( settings, *scene, cam );
+            auto full = image_t( image_height, std::vector<color_t>( image_width, color_t{} ) );
+            render( pool, settings, jobs, full, false );
+
+            for( int row = 0; row < image_height; row++ )
+            {
+                for( int col = 0; col < image_width; col++ )
+                {
+                    const color_t &a = edited[row][col];
+                    const color_t &b = full[row][col];
+                    if( a.x != b.x || a.y != b.y || a.z != b.z )
+                        mismatches++;
+                }
+            }
+
+            if( mismatches == 0 )
+                std::cerr << "Check: the edited image matches a full render\n";
+            else
+                std::cerr << "Check: " << mismatches << " pixels differ from a full render\n";
         }
+
+        std::cerr << "Writing image\n";
+        write_image( std::cout, settings, edited );
+        std::cerr << "\nDone" << std::endl;
+
+        print_texture_stats( *scene );
+        perf_counters_report( std::cerr );
+        write_trace( trace_path );
+        return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
+    // camera_t
+    camera_t cam{ scene->camera, aspect_ratio, image_height };
+
+    // Render
+
+    std::vector<Job> jobs = create_jobs( settings, *scene, cam );
+
     // std::cerr << "\n";
     std::cerr << "Created " << job_count << " jobs\n";
 
-    auto pixel = std::vector<std::vector<color_t>>( image_height, std::vector<color_t>( image_width, color_t{} ) );
-    render( image_width, image_height, jobs, pixel );
+    if( deadline_ms > 0.0 )
+    {
+        const auto deadline = start
+                              + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  std::chrono::duration<double, std::milli>( deadline_ms ) );
+        auto accumulation = accumulation_buffer_t( image_width, image_height );
+        const budget_report_t report = render_within_budget( pool, settings, jobs, accumulation, deadline );
+
+        std::cerr << "Budget of " << deadline_ms << " ms: " << report.passes << " passes, " << report.min_samples
+                  << '-' << report.max_samples << " samples per pixel, depth " << report.max_depth << ", calibration "
+                  << report.calibration_ms << " ms, render " << report.render_ms << " ms, "
+                  << report.rays_per_second / 1e6 << " Mrays/s, relative error " << report.relative_error << '\n';
+        if( report.overrun_ms > 0.0 )
+            std::cerr << "Deadline missed, the first pass finished " << report.overrun_ms << " ms late\n";
+
+        std::cerr << "Writing image\n";
+        write_image( std::cout, accumulation );
+        std::cerr << "\nDone" << std::endl;
+
+        print_texture_stats( *scene );
+        perf_counters_report( std::cerr );
+        write_trace( trace_path );
+        return EXIT_SUCCESS;
+    }
+
+    // With first touch the rows are left empty for the workers to allocate on their nodes, with a copy of their jobs
+    auto pixel = first_touch ? image_t( image_height )
+                             : image_t( image_height, std::vector<color_t>( image_width, color_t{} ) );
+    std::vector<node_report_t> nodes;
+    render( pool, settings, jobs, pixel, true, placement, &nodes );
 
     std::cerr << "Jobs finished\n";
     std::cerr << "Writing image\n";
 
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-    for( int row = image_height - 1; row >= 0; row-- )
-    {
-        for( int col = 0; col < image_width; col++ )
-        {
-            write_color( std::cout, pixel[row][col], samples_per_pixel_x * samples_per_pixel_y );
-        }
-    }
+    write_image( std::cout, settings, pixel );
 
     std::cerr << "\nDone" << std::endl;
 
+    if( numa_report )
+        print_node_report( nodes );
+    print_texture_stats( *scene );
+    perf_counters_report( std::cerr );
+    write_trace( trace_path );
     return EXIT_SUCCESS;
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
 #include <memory>
 
 #include "vec3.hpp"
@@ -16,4 +19,50 @@ public:
                           random_number_generator_t &rng,
                           color_t &attenuation,
                           ray_t &scattered ) const = 0;
+
+    virtual color_t emitted( const hit_record_t &rec ) const
+    {
+        return color_t{ 0.0, 0.0, 0.0 };
+    }
+
+    // Light sampling needs the BSDF for directions that scatter() did not choose. Materials that cannot evaluate
+    // it (mirrors, glass, fuzzy metal) stay specular and are only sampled through scatter().
+    virtual bool is_specular() const
+    {
+        return true;
+    }
+
+    // BSDF times cosine towards direction
+    virtual color_t eval( const hit_record_t &rec, const vec3_t &direction ) const
+    {
+        return color_t{ 0.0, 0.0, 0.0 };
+    }
+
+    // Solid angle density with which scatter() picks direction
+    virtual double pdf( const hit_record_t &rec, const vec3_t &direction ) const
+    {
+        return 0.0;
+    }
+
+    // Materials of one kind with equal parameters are interchangeable, material_pool_t keeps one of them. By default
+    // a material only equals itself.
+    virtual bool same_as( const material_t &other ) const
+    {
+        return this == &other;
+    }
+
+    // Equal for materials that are the same_as each other
+    virtual size_t hash() const
+    {
+        return std::hash<const material_t *>()( this );
+    }
+
+protected:
+    static size_t hash_values( std::initializer_list<double> values )
+    {
+        size_t h = 0;
+        for( const double v : values )
+            h ^= std::hash<double>()( v ) + 0x9e3779b97f4a7c15ull + ( h << 6 ) + ( h >> 2 );
+        return h;
+    }
 };
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+#include "material.hpp"
+
+// Hands out one shared instance per distinct material while a scene is built, so that every glass sphere of a scene,
+// or every copy of an instanced prototype, refers to the same material object instead of an equal copy of it
+class material_pool_t
+{
+public:
+    // An earlier material that is the same_as m, or m itself when there is none
+    std::shared_ptr<material_t> intern( std::shared_ptr<material_t> m )
+    {
+        requested_++;
+        const size_t h = m->hash();
+        const auto range = materials.equal_range( h );
+        for( auto it = range.first; it != range.second; ++it )
+        {
+            if( it->second->same_as( *m ) )
+                return it->second;
+        }
+        materials.emplace( h, m );
+        return m;
+    }
+
+    template <typename material_type_t, typename... args_t>
+    std::shared_ptr<material_t> make( args_t &&...args )
+    {
+        return intern( std::make_shared<material_type_t>( std::forward<args_t>( args )... ) );
+    }
+
+    // Materials passed to intern()
+    size_t requested() const
+    {
+        return requested_;
+    }
+
+    size_t unique() const
+    {
+        return materials.size();
+    }
+
+private:
+    std::unordered_multimap<size_t, std::shared_ptr<material_t>> materials;
+    size_t requested_{ 0 };
+};
@@ -1,12 +1,23 @@
 #pragma once
 
+#include <memory>
+
 #include "material.hpp"
+#include "texture.hpp"
 
 class metal_t : public material_t
 {
 public:
     metal_t( const color_t &a, double f ) : albedo( a ), fuzz( f < 1.0 ? f : 1.0 ) { }
 
+    // The texture tints the reflection, albedo scales it
+    metal_t( std::shared_ptr<texture_t> t, double f, const color_t &a = color_t{ 1.0, 1.0, 1.0 } )
+        : albedo( a ),
+          fuzz( f < 1.0 ? f : 1.0 ),
+          texture( std::move( t ) )
+    {
+    }
+
     virtual color_t diffuse() const override
     {
         return albedo;
@@ -19,12 +30,25 @@ public:
                           ray_t &scattered ) const override
     {
         vec3_t reflected = reflect( unit_vector( r_in.direction() ), rec.normal );
-        scattered = ray_t( rec.p, reflected + fuzz * rng.random_in_unit_sphere() );
-        attenuation = albedo;
+        scattered = ray_t( rec.p, reflected + fuzz * rng.random_in_unit_sphere(), r_in.spread() );
+        attenuation = texture ? albedo * texture->value( rec ) : albedo;
         return dot( scattered.direction(), rec.normal ) > 0.0;
     }
 
+    virtual bool same_as( const material_t &other ) const override
+    {
+        const auto *o = dynamic_cast<const metal_t *>( &other );
+        return o && o->albedo == albedo && o->fuzz == fuzz && o->texture == texture;
+    }
+
+    virtual size_t hash() const override
+    {
+        return hash_values( { 2.0, albedo.x, albedo.y, albedo.z, fuzz } )
+               ^ std::hash<const texture_t *>()( texture.get() );
+    }
+
 public:
     color_t albedo;
     double fuzz;
+    std::shared_ptr<texture_t> texture; // nullptr for a constant albedo
 };
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <cmath>
+
+#include "material.hpp"
+#include "hittable.hpp"
+
+// Parallelogram with corner q and edges u and v, the front face is on the side of cross( u, v )
+class parallelogram_t : public hittable_t
+{
+public:
+    parallelogram_t( const point3_t &q, const vec3_t &u, const vec3_t &v, std::shared_ptr<material_t> m )
+        : q_( q ),
+          u_( u ),
+          v_( v ),
+          material_( m )
+    {
+        const vec3_t n = cross( u_, v_ );
+        normal_ = unit_vector( n );
+        d_ = dot( normal_, q_ );
+        w_ = n / dot( n, n );
+        area_ = length( n );
+    }
+
+    virtual bool hit( const ray_t &r, double t_min, double t_max, hit_record_t &rec ) const override
+    {
+        const auto denominator = dot( normal_, r.direction() );
+
+        // Parallel to the plane
+        if( fabs( denominator ) < 1e-8 )
+            return false;
+
+        const auto t = ( d_ - dot( normal_, r.origin() ) ) / denominator;
+        if( t < t_min || t_max < t )
+            return false;
+
+        // Planar coordinates of the hit point along u and v
+        const point3_t p = r.at( t );
+        const vec3_t planar = p - q_;
+        const auto alpha = dot( w_, cross( planar, v_ ) );
+        const auto beta = dot( w_, cross( u_, planar ) );
+        if( alpha < 0.0 || alpha > 1.0 || beta < 0.0 || beta > 1.0 )
+            return false;
+
+        rec.t = t;
+        rec.p = p;
+        rec.set_face_normal( r, normal_ );
+        rec.material = material_;
+        rec.object = this;
+
+        return true;
+    }
+
+    virtual aabb_t bounding_box() const override
+    {
+        aabb_t box;
+        box.expand( q_ );
+        box.expand( q_ + u_ );
+        box.expand( q_ + v_ );
+        box.expand( q_ + u_ + v_ );
+
+        // Keep axis aligned quads from producing a flat box
+        constexpr double padding = 1e-4;
+        box.min = box.min - vec3_t{ padding, padding, padding };
+        box.max = box.max + vec3_t{ padding, padding, padding };
+        return box;
+    }
+
+    // Uniform over the area, converted to solid angle
+    virtual double pdf_value( const point3_t &origin, const vec3_t &direction ) const override
+    {
+        hit_record_t rec;
+        if( !hit( ray_t( origin, direction ), 0.001, infinity, rec ) )
+            return 0.0;
+
+        const auto distance_squared = rec.t * rec.t * length_squared( direction );
+        const auto cosine = fabs( dot( direction, rec.normal ) / length( direction ) );
+        if( cosine < 1e-8 )
+            return 0.0;
+
+        return distance_squared / ( cosine * area_ );
+    }
+
+    virtual vec3_t random_direction( const point3_t &origin, random_number_generator_t &rng ) const override
+    {
+        const point3_t p = q_ + rng.random_double() * u_ + rng.random_double() * v_;
+        return p - origin;
+    }
+
+    double area() const
+    {
+        return area_;
+    }
+
+private:
+    point3_t q_;
+    vec3_t u_;
+    vec3_t v_;
+    vec3_t normal_;
+    vec3_t w_;
+    double d_;
+    double area_;
+    std::shared_ptr<material_t> material_;
+};
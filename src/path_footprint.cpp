@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <cmath>
+
+#include "path_footprint.hpp"
+
+namespace
+{
+    // Segments crossing more fine cells than this are walked through the coarse ones
+    constexpr double long_segment_cells = 4.0;
+} // namespace
+
+footprint_grid_t::footprint_grid_t( const aabb_t &box, size_t target_cells )
+{
+    constexpr int max_cells_per_axis = 1024;
+
+    region = box.empty() ? aabb_t{ point3_t{ -1.0, -1.0, -1.0 }, point3_t{ 1.0, 1.0, 1.0 } } : box;
+
+    // Flat regions still get cells of some thickness
+    vec3_t extent = region.max - region.min;
+    const double thickness = 1e-3 * std::max( { extent.x, extent.y, extent.z, 1e-3 } );
+    region.max = point3_t{ region.min.x + std::max( extent.x, thickness ),
+                           region.min.y + std::max( extent.y, thickness ),
+                           region.min.z + std::max( extent.z, thickness ) };
+    extent = region.max - region.min;
+
+    const double side = std::cbrt( extent.x * extent.y * extent.z / double( std::max<size_t>( target_cells, 1 ) ) );
+    for( int a = 0; a < 3; a++ )
+    {
+        fine.cells[a] = std::clamp( static_cast<int>( std::ceil( axis( extent, a ) / side ) ), 1, max_cells_per_axis );
+        coarse.cells[a] = ( fine.cells[a] + coarse_factor - 1 ) / coarse_factor;
+    }
+    fine.cell_size = vec3_t{ extent.x / fine.cells[0], extent.y / fine.cells[1], extent.z / fine.cells[2] };
+    coarse.cell_size = vec3_t{ extent.x / coarse.cells[0], extent.y / coarse.cells[1], extent.z / coarse.cells[2] };
+}
+
+path_footprint_t::path_footprint_t( const footprint_grid_t &grid )
+    : grid( &grid ),
+      fine_bits( ( grid.fine.cell_count() + 63 ) / 64, 0 ),
+      coarse_bits( ( grid.coarse.cell_count() + 63 ) / 64, 0 )
+{
+}
+
+void path_footprint_t::clear()
+{
+    objects.clear();
+    std::fill( fine_bits.begin(), fine_bits.end(), 0 );
+    std::fill( coarse_bits.begin(), coarse_bits.end(), 0 );
+    left_region = false;
+}
+
+void path_footprint_t::add_hit( const hittable_t *object )
+{
+    if( objects.empty() || objects.back() != object )
+        objects.push_back( object );
+}
+
+void path_footprint_t::add_segment( const ray_t &r, double t_min, double t_max )
+{
+    const point3_t origin = r.origin();
+    const vec3_t direction = r.direction();
+
+    // Clip to the region
+    double t0 = t_min;
+    double t1 = t_max;
+    for( int a = 0; a < 3; a++ )
+    {
+        const double o = axis( origin, a );
+        const double d = axis( direction, a );
+        const double lo = axis( grid->region.min, a );
+        const double hi = axis( grid->region.max, a );
+        if( d == 0.0 )
+        {
+            if( o < lo || o > hi )
+            {
+                left_region = true;
+                return;
+            }
+            continue;
+        }
+
+        double enter = ( lo - o ) / d;
+        double exit = ( hi - o ) / d;
+        if( enter > exit )
+            std::swap( enter, exit );
+        t0 = std::max( t0, enter );
+        t1 = std::min( t1, exit );
+    }
+
+    if( t0 > t_min || t1 < t_max )
+        left_region = true;
+    if( t0 > t1 )
+        return;
+
+    const vec3_t span = ( t1 - t0 ) * direction;
+    const vec3_t &size = grid->fine.cell_size;
+    const double fine_cells
+        = std::fabs( span.x ) / size.x + std::fabs( span.y ) / size.y + std::fabs( span.z ) / size.z;
+    if( fine_cells > long_segment_cells )
+        walk( *grid, grid->coarse, coarse_bits, r, t0, t1 );
+    else
+        walk( *grid, grid->fine, fine_bits, r, t0, t1 );
+}
+
+// Marks the cells of level that r crosses from t0 to t1, one cell boundary at a time
+void path_footprint_t::walk( const footprint_grid_t &grid,
+                             const level_t &level,
+                             std::vector<uint64_t> &bits,
+                             const ray_t &r,
+                             double t0,
+                             double t1 )
+{
+    const point3_t origin = r.origin();
+    const vec3_t direction = r.direction();
+    const ptrdiff_t axis_stride[3] = { 1, level.cells[0], ptrdiff_t( level.cells[0] ) * level.cells[1] };
+
+    ptrdiff_t cell = 0;
+    ptrdiff_t stride[3];
+    int remaining[3]; // steps left before the walk leaves the grid
+    double t_next[3];
+    double t_delta[3];
+    const point3_t start = r.at( t0 );
+    for( int a = 0; a < 3; a++ )
+    {
+        const double lo = axis( grid.region.min, a );
+        const double size = axis( level.cell_size, a );
+        const double d = axis( direction, a );
+
+        const double position = std::floor( ( axis( start, a ) - lo ) / size );
+        const int index = static_cast<int>( std::clamp( position, 0.0, double( level.cells[a] - 1 ) ) );
+        cell += index * axis_stride[a];
+        if( d == 0.0 )
+        {
+            stride[a] = 0;
+            remaining[a] = 0;
+            t_next[a] = infinity;
+            t_delta[a] = infinity;
+            continue;
+        }
+
+        stride[a] = d > 0.0 ? axis_stride[a] : -axis_stride[a];
+        remaining[a] = d > 0.0 ? level.cells[a] - 1 - index : index;
+        t_next[a] = ( lo + ( index + ( d > 0.0 ? 1 : 0 ) ) * size - axis( origin, a ) ) / d;
+        t_delta[a] = size / std::fabs( d );
+    }
+
+    for( ;; )
+    {
+        bits[size_t( cell ) / 64] |= uint64_t( 1 ) << ( size_t( cell ) % 64 );
+
+        const int a = t_next[0] < t_next[1] ? ( t_next[0] < t_next[2] ? 0 : 2 ) : ( t_next[1] < t_next[2] ? 1 : 2 );
+        if( t_next[a] > t1 || remaining[a] == 0 )
+            break;
+
+        remaining[a]--;
+        cell += stride[a];
+        t_next[a] += t_delta[a];
+    }
+}
+
+void path_footprint_t::finish()
+{
+    std::sort( objects.begin(), objects.end() );
+    objects.erase( std::unique( objects.begin(), objects.end() ), objects.end() );
+}
+
+bool path_footprint_t::hit( const hittable_t *object ) const
+{
+    return std::binary_search( objects.begin(), objects.end(), object );
+}
+
+bool path_footprint_t::crosses( const aabb_t &box ) const
+{
+    if( box.empty() )
+        return false;
+
+    const aabb_t &region = grid->region;
+    const bool inside = box.min.x >= region.min.x && box.min.y >= region.min.y && box.min.z >= region.min.z
+                        && box.max.x <= region.max.x && box.max.y <= region.max.y && box.max.z <= region.max.z;
+    if( !inside && left_region )
+        return true;
+
+    return any_marked( grid->fine, fine_bits, box ) || any_marked( grid->coarse, coarse_bits, box );
+}
+
+bool path_footprint_t::any_marked( const level_t &level, const std::vector<uint64_t> &bits, const aabb_t &box ) const
+{
+    // Widened by a sliver so that a box touching a cell boundary also tests the cells on its other side, which
+    // covers segments the walk passed by within rounding error
+    int first[3];
+    int last[3];
+    for( int a = 0; a < 3; a++ )
+    {
+        const double lo = axis( grid->region.min, a );
+        const double size = axis( level.cell_size, a );
+        const double margin = 1e-6 * size;
+        const double from = ( axis( box.min, a ) - margin - lo ) / size;
+        const double to = ( axis( box.max, a ) + margin - lo ) / size;
+        if( to < 0.0 || from >= level.cells[a] )
+            return false;
+
+        first[a] = static_cast<int>( std::max( 0.0, std::floor( from ) ) );
+        last[a] = static_cast<int>( std::min( double( level.cells[a] - 1 ), std::floor( to ) ) );
+    }
+
+    for( int z = first[2]; z <= last[2]; z++ )
+    {
+        for( int y = first[1]; y <= last[1]; y++ )
+        {
+            for( int x = first[0]; x <= last[0]; x++ )
+            {
+                const size_t cell = ( size_t( z ) * level.cells[1] + y ) * level.cells[0] + x;
+                if( bits[cell / 64] & ( uint64_t( 1 ) << ( cell % 64 ) ) )
+                    return true;
+            }
+        }
+    }
+    return false;
+}
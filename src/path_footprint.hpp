@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "ray.hpp"
+
+// Two uniform grids over a region of the scene: fine cells, about target_cells of them and as close to cubes as the
+// region allows, and coarse cells of coarse_factor fine ones per side, which long segments are walked through
+class footprint_grid_t
+{
+public:
+    static constexpr int coarse_factor = 4;
+
+    class level_t
+    {
+    public:
+        size_t cell_count() const
+        {
+            return size_t( cells[0] ) * cells[1] * cells[2];
+        }
+
+    public:
+        int cells[3]{ 0, 0, 0 };
+        vec3_t cell_size;
+    };
+
+    footprint_grid_t() = default;
+    footprint_grid_t( const aabb_t &region, size_t target_cells );
+
+public:
+    aabb_t region;
+    level_t fine;
+    level_t coarse;
+};
+
+// What the paths of a tile touched: the objects their rays hit and, conservatively, the grid cells their segments
+// and shadow rays crossed. Of the parts outside the grid's region only their existence is kept.
+class path_footprint_t
+{
+public:
+    path_footprint_t() = default;
+    explicit path_footprint_t( const footprint_grid_t &grid );
+
+    void clear();
+    void add_hit( const hittable_t *object );
+
+    // The part of r from t_min to t_max, which may be infinity for rays that left the scene
+    void add_segment( const ray_t &r, double t_min, double t_max );
+
+    // Sorts the objects for hit()
+    void finish();
+
+    bool hit( const hittable_t *object ) const;
+
+    // False only if no segment can cross box
+    bool crosses( const aabb_t &box ) const;
+
+private:
+    using level_t = footprint_grid_t::level_t;
+
+    static void walk( const footprint_grid_t &grid,
+                      const level_t &level,
+                      std::vector<uint64_t> &bits,
+                      const ray_t &r,
+                      double t0,
+                      double t1 );
+    bool any_marked( const level_t &level, const std::vector<uint64_t> &bits, const aabb_t &box ) const;
+
+private:
+    const footprint_grid_t *grid{ nullptr };
+    std::vector<const hittable_t *> objects;
+    std::vector<uint64_t> fine_bits; // one bit per cell
+    std::vector<uint64_t> coarse_bits;
+    bool left_region{ false };
+};
@@ -0,0 +1,455 @@
+#include "perf_counters.hpp"
+
+#if defined( __linux__ )
+
+#    include <algorithm>
+#    include <atomic>
+#    include <cerrno>
+#    include <cstring>
+#    include <iomanip>
+#    include <map>
+#    include <memory>
+#    include <mutex>
+#    include <vector>
+
+#    include <linux/perf_event.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+
+namespace
+{
+    constexpr int counter_count = perf_zone_t::counter_count;
+
+    enum counter_t
+    {
+        cycles,
+        instructions,
+        l1d_misses,
+        llc_misses,
+        branch_misses
+    };
+
+    const char *const counter_names[counter_count]
+        = { "cycles", "instructions", "L1D misses", "LLC misses", "branch misses" };
+
+    struct zone_stats_t
+    {
+        bool tile;
+        uint64_t calls{ 0 };
+        double total[counter_count]{};
+        uint64_t rays{ 0 };
+        double min_ipc{ 0.0 };
+        double max_ipc{ 0.0 };
+        double max_cycles_per_ray{ 0.0 };
+        int64_t slowest_index{ -1 };
+    };
+
+    // One per thread that opened counters, registered until the thread ends. Tiles add to the zones of their own
+    // thread, whose mutex only the report contends for.
+    struct thread_counters_t
+    {
+        std::string name;
+        int fds[counter_count];
+        std::atomic<uint64_t> tiles{ 0 };
+        std::atomic<uint64_t> rays{ 0 }; // traced inside tiles
+        std::mutex zones_mutex;
+        std::map<std::string, zone_stats_t> zones;
+    };
+
+    // Hands the counters of a thread that ends over to the retired totals
+    struct thread_slot_t
+    {
+        thread_counters_t *counters{ nullptr };
+        ~thread_slot_t();
+    };
+
+    std::atomic<bool> counters_enabled{ false };
+    uint64_t ( *ray_counter )() = nullptr;
+    bool available[counter_count];
+
+    std::mutex registry_mutex;
+    std::vector<std::unique_ptr<thread_counters_t>> registry;
+    std::map<std::string, zone_stats_t> zones; // phases, and tiles of the threads that have ended
+    size_t threads_opened = 0;
+    size_t threads_retired = 0;
+    double retired_values[counter_count]{}; // final counts of the threads that have ended
+    uint64_t retired_tiles = 0;
+    uint64_t retired_rays = 0;
+    std::atomic<uint64_t> tile_rays{ 0 }; // of all finished tiles, phases take their ray count from it
+    thread_local thread_slot_t this_thread;
+
+    int open_counter( int counter )
+    {
+        perf_event_attr attr;
+        std::memset( &attr, 0, sizeof( attr ) );
+        attr.size = sizeof( attr );
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        switch( counter )
+        {
+        case cycles:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case instructions:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case l1d_misses:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | ( PERF_COUNT_HW_CACHE_OP_READ << 8 )
+                          | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+            break;
+        case llc_misses:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        default:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        }
+
+        // The calling thread on any CPU
+        return static_cast<int>( syscall( SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC ) );
+    }
+
+    double read_counter( int fd )
+    {
+        uint64_t data[3]; // value, time enabled, time running
+        if( fd < 0 || read( fd, data, sizeof( data ) ) != sizeof( data ) || data[2] == 0 )
+            return 0.0;
+
+        // Events that shared the hardware with others were only counted part of the time
+        return data[2] < data[1] ? double( data[0] ) * data[1] / data[2] : double( data[0] );
+    }
+
+    void read_thread( const thread_counters_t &counters, double values[counter_count] )
+    {
+        for( int i = 0; i < counter_count; i++ )
+            values[i] = read_counter( counters.fds[i] );
+    }
+
+    void read_all_threads( double values[counter_count] )
+    {
+        std::lock_guard<std::mutex> lock( registry_mutex );
+        std::copy( retired_values, retired_values + counter_count, values );
+        for( const auto &counters : registry )
+        {
+            double thread_values[counter_count];
+            read_thread( *counters, thread_values );
+            for( int i = 0; i < counter_count; i++ )
+                values[i] += thread_values[i];
+        }
+    }
+
+    // Caller holds registry_mutex
+    void register_locked( std::unique_ptr<thread_counters_t> counters )
+    {
+        if( counters->name.empty() )
+            counters->name = std::to_string( threads_opened );
+        threads_opened++;
+        this_thread.counters = counters.get();
+        registry.push_back( std::move( counters ) );
+    }
+
+    thread_counters_t &thread_counters()
+    {
+        if( !this_thread.counters )
+        {
+            auto opened = std::make_unique<thread_counters_t>();
+            for( int i = 0; i < counter_count; i++ )
+                opened->fds[i] = available[i] ? open_counter( i ) : -1;
+
+            std::lock_guard<std::mutex> lock( registry_mutex );
+            register_locked( std::move( opened ) );
+        }
+        return *this_thread.counters;
+    }
+
+    void add_sample( zone_stats_t &stats, bool tile, const double values[counter_count], uint64_t rays, int64_t index )
+    {
+        const bool first = stats.calls == 0;
+        stats.tile = tile;
+        stats.calls++;
+        for( int i = 0; i < counter_count; i++ )
+            stats.total[i] += values[i];
+        stats.rays += rays;
+
+        const double ipc = values[cycles] > 0.0 ? values[instructions] / values[cycles] : 0.0;
+        stats.min_ipc = first ? ipc : std::min( stats.min_ipc, ipc );
+        stats.max_ipc = first ? ipc : std::max( stats.max_ipc, ipc );
+
+        // Tiles that need many cycles per ray point at expensive parts of the image
+        if( tile && rays > 0 && available[cycles] && values[cycles] / rays > stats.max_cycles_per_ray )
+        {
+            stats.max_cycles_per_ray = values[cycles] / rays;
+            stats.slowest_index = index;
+        }
+    }
+
+    void merge_zones( std::map<std::string, zone_stats_t> &into, const std::map<std::string, zone_stats_t> &from )
+    {
+        for( const auto &[name, stats] : from )
+        {
+            auto [entry, inserted] = into.try_emplace( name, stats );
+            if( inserted )
+                continue;
+
+            zone_stats_t &merged = entry->second;
+            merged.calls += stats.calls;
+            for( int i = 0; i < counter_count; i++ )
+                merged.total[i] += stats.total[i];
+            merged.rays += stats.rays;
+            merged.min_ipc = std::min( merged.min_ipc, stats.min_ipc );
+            merged.max_ipc = std::max( merged.max_ipc, stats.max_ipc );
+            if( stats.max_cycles_per_ray > merged.max_cycles_per_ray )
+            {
+                merged.max_cycles_per_ray = stats.max_cycles_per_ray;
+                merged.slowest_index = stats.slowest_index;
+            }
+        }
+    }
+
+    thread_slot_t::~thread_slot_t()
+    {
+        if( !counters )
+            return;
+
+        std::lock_guard<std::mutex> lock( registry_mutex );
+
+        double values[counter_count];
+        read_thread( *counters, values );
+        for( int i = 0; i < counter_count; i++ )
+        {
+            retired_values[i] += values[i];
+            if( counters->fds[i] >= 0 )
+                close( counters->fds[i] );
+        }
+        retired_tiles += counters->tiles;
+        retired_rays += counters->rays;
+        threads_retired++;
+        {
+            std::lock_guard<std::mutex> zones_lock( counters->zones_mutex );
+            merge_zones( zones, counters->zones );
+        }
+
+        registry.erase( std::find_if( registry.begin(),
+                                      registry.end(),
+                                      [this]( const std::unique_ptr<thread_counters_t> &entry )
+                                      { return entry.get() == counters; } ) );
+        counters = nullptr;
+    }
+
+    // tile_stats adds the range of IPC across tiles
+    void write_counts( std::ostream &out,
+                       const double values[counter_count],
+                       uint64_t rays,
+                       const zone_stats_t *tile_stats = nullptr )
+    {
+        if( available[cycles] )
+            out << ", " << values[cycles] / 1e6 << " Mcycles";
+        if( available[cycles] && available[instructions] )
+        {
+            out << ", IPC " << ( values[cycles] > 0.0 ? values[instructions] / values[cycles] : 0.0 );
+            if( tile_stats )
+                out << " (" << tile_stats->min_ipc << " to " << tile_stats->max_ipc << " across tiles)";
+        }
+        else
+            out << ", IPC n/a";
+
+        if( rays == 0 )
+            return;
+
+        out << ", " << rays / 1e6 << " Mrays, per ray:";
+        for( int i = 0; i < counter_count; i++ )
+        {
+            if( i == instructions )
+                continue;
+            out << ( i == cycles ? " " : ", " );
+            if( available[i] )
+                out << values[i] / rays;
+            else
+                out << "n/a";
+            out << ' ' << counter_names[i];
+        }
+    }
+} // namespace
+
+bool perf_counters_start( uint64_t ( *rays_traced_by_thread )(), std::string &error )
+{
+    if( counters_enabled )
+        return true;
+
+    // Probe each event on the calling thread, keeping its counters
+    int first_errno = 0;
+    bool any = false;
+    auto counters = std::make_unique<thread_counters_t>();
+    counters->name = "main";
+    for( int i = 0; i < counter_count; i++ )
+    {
+        counters->fds[i] = open_counter( i );
+        available[i] = counters->fds[i] >= 0;
+        any = any || available[i];
+        if( !available[i] && first_errno == 0 )
+            first_errno = errno;
+    }
+
+    if( !any )
+    {
+        error = std::strerror( first_errno );
+        if( first_errno == EACCES || first_errno == EPERM )
+            error += ", perf_event_open is not permitted (container or kernel.perf_event_paranoid)";
+        else if( first_errno == ENOENT || first_errno == EOPNOTSUPP || first_errno == ENODEV )
+            error += ", the CPU or virtual machine exposes no hardware counters";
+        return false;
+    }
+
+    ray_counter = rays_traced_by_thread;
+    {
+        std::lock_guard<std::mutex> lock( registry_mutex );
+        register_locked( std::move( counters ) );
+    }
+    counters_enabled = true;
+    return true;
+}
+
+void perf_counters_report( std::ostream &out )
+{
+    if( !counters_enabled )
+        return;
+
+    std::lock_guard<std::mutex> lock( registry_mutex );
+
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+    out << std::fixed << std::setprecision( 2 );
+
+    out << "Performance counters, user space only";
+    for( int i = 0; i < counter_count; i++ )
+    {
+        if( !available[i] )
+            out << ", no " << counter_names[i];
+    }
+    out << '\n';
+
+    auto all_zones = zones;
+    for( const auto &counters : registry )
+    {
+        std::lock_guard<std::mutex> zones_lock( counters->zones_mutex );
+        merge_zones( all_zones, counters->zones );
+    }
+
+    // Phases first, then tiles
+    for( const bool tile : { false, true } )
+    {
+        for( const auto &[name, stats] : all_zones )
+        {
+            if( stats.tile != tile )
+                continue;
+
+            out << "  " << ( tile ? "tile " : "phase " ) << name << ": " << stats.calls << " calls";
+            write_counts( out, stats.total, stats.rays, tile ? &stats : nullptr );
+            if( stats.slowest_index >= 0 )
+                out << ", most cycles per ray at index " << stats.slowest_index << " ("
+                    << stats.max_cycles_per_ray << ')';
+            out << '\n';
+        }
+    }
+
+    for( const auto &counters : registry )
+    {
+        double values[counter_count];
+        read_thread( *counters, values );
+        out << "  thread " << counters->name << ": " << counters->tiles << " tiles";
+        write_counts( out, values, counters->rays );
+        out << '\n';
+    }
+
+    if( threads_retired > 0 )
+    {
+        out << "  " << threads_retired << " ended threads: " << retired_tiles << " tiles";
+        write_counts( out, retired_values, retired_rays );
+        out << '\n';
+    }
+
+    out.flags( flags );
+    out.precision( precision );
+}
+
+perf_zone_t::perf_zone_t( const char *name, bool tile, int64_t index )
+    : name( name ),
+      tile( tile ),
+      active( counters_enabled.load( std::memory_order_relaxed ) ),
+      index( index ),
+      start_rays( 0 )
+{
+    if( !active )
+        return;
+
+    if( tile )
+    {
+        start_rays = ray_counter();
+        read_thread( thread_counters(), start );
+    }
+    else
+    {
+        thread_counters();
+        start_rays = tile_rays;
+        read_all_threads( start );
+    }
+}
+
+perf_zone_t::~perf_zone_t()
+{
+    if( !active )
+        return;
+
+    double values[counter_count];
+    uint64_t rays;
+    if( tile )
+    {
+        thread_counters_t &counters = thread_counters();
+        read_thread( counters, values );
+        rays = ray_counter() - start_rays;
+        counters.tiles++;
+        counters.rays += rays;
+        tile_rays += rays;
+    }
+    else
+    {
+        read_all_threads( values );
+        rays = tile_rays - start_rays;
+    }
+
+    for( int i = 0; i < counter_count; i++ )
+        values[i] -= start[i];
+
+    if( tile )
+    {
+        thread_counters_t &counters = thread_counters();
+        std::lock_guard<std::mutex> lock( counters.zones_mutex );
+        add_sample( counters.zones[name], true, values, rays, index );
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock( registry_mutex );
+        add_sample( zones[name], false, values, rays, index );
+    }
+}
+
+#else
+
+bool perf_counters_start( uint64_t ( * )(), std::string &error )
+{
+    error = "hardware counters are only read on Linux";
+    return false;
+}
+
+void perf_counters_report( std::ostream & )
+{
+}
+
+#endif
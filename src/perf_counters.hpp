@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Hardware performance counters of each thread read with Linux perf_event_open: cycles, instructions, L1 data cache
+// read misses, last level cache misses and branch misses, user space only. Two kinds of zones sample them. A phase
+// adds up the counters of every thread that has opened them, so the work it hands to the thread pool is included;
+// phases that overlap, like concurrent server requests, also see each other's work. A tile counts the calling thread
+// only, together with the rays it traced. Zones cost a flag check until perf_counters_start() has been called, and
+// compile to nothing on other systems. Zone names must be string literals.
+
+#if defined( __linux__ )
+#    define PERF_CONCAT_INNER( a, b ) a##b
+#    define PERF_CONCAT( a, b ) PERF_CONCAT_INNER( a, b )
+#    define PERF_PHASE( name ) perf_zone_t PERF_CONCAT( perf_zone_, __LINE__ )( name, false )
+#    define PERF_TILE( name, index ) perf_zone_t PERF_CONCAT( perf_zone_, __LINE__ )( name, true, index )
+#else
+#    define PERF_PHASE( name ) ( (void)0 )
+#    define PERF_TILE( name, index ) ( (void)0 )
+#endif
+
+// Opens the counters of the calling thread, the others open theirs in their first zone. rays_traced_by_thread returns
+// the number of rays the calling thread has traced so far. Returns false with the reason in error when no counter can
+// be opened, e.g. in a container, in a virtual machine without a PMU or with kernel.perf_event_paranoid above 2.
+// Counters that only some of the events lack are reported as n/a.
+bool perf_counters_start( uint64_t ( *rays_traced_by_thread )(), std::string &error );
+
+// IPC and misses per ray of every zone name and every thread, nothing if the counters were never started
+void perf_counters_report( std::ostream &out );
+
+#if defined( __linux__ )
+class perf_zone_t
+{
+public:
+    static constexpr int counter_count = 5;
+
+    perf_zone_t( const char *name, bool tile, int64_t index = -1 );
+    ~perf_zone_t();
+
+    perf_zone_t( const perf_zone_t & ) = delete;
+    perf_zone_t &operator=( const perf_zone_t & ) = delete;
+
+private:
+    const char *name;
+    bool tile;
+    bool active;
+    int64_t index;
+    double start[counter_count];
+    uint64_t start_rays;
+};
+#endif
@@ -6,7 +6,12 @@ class ray_t
 {
 public:
     ray_t() { }
-    ray_t( const point3_t &origin, const vec3_t &direction ) : origin_( origin ), direction_( direction ) { }
+    ray_t( const point3_t &origin, const vec3_t &direction, double spread = 0.0 )
+        : origin_( origin ),
+          direction_( direction ),
+          spread_( spread )
+    {
+    }
 
     point3_t origin() const
     {
@@ -17,6 +22,12 @@ public:
         return direction_;
     }
 
+    // Angle in radians by which the ray's footprint widens, per unit of distance. Picks texture mip levels.
+    double spread() const
+    {
+        return spread_;
+    }
+
     point3_t at( double t ) const
     {
         return origin_ + t * direction_;
@@ -25,4 +36,5 @@ public:
 private:
     point3_t origin_;
     vec3_t direction_;
+    double spread_{ 0.0 };
 };
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "aabb.hpp"
+#include "hit_record.hpp"
+#include "ray.hpp"
+#include "vec3.hpp"
+#include "utils.hpp"
+
+// Up to max_size coherent rays, e.g. one camera ray per pixel of an 8x8 block, traced together to their closest
+// hits. Bounding volumes are first tested against the whole packet with interval arithmetic: the origins and the
+// inverse directions of all rays are bounded per axis, a box that none of the rays can enter is rejected by one
+// test instead of one per ray. Boxes that pass narrow the set of active rays, which primitives are tested against.
+class ray_packet_t
+{
+public:
+    static constexpr int max_size = 64;
+
+    void clear()
+    {
+        size_ = 0;
+        active_ = 0;
+    }
+
+    // The ray starts without a hit, t_max is the farthest hit that counts
+    void add( const ray_t &r, double t_max )
+    {
+        rays_[size_] = r;
+        t_max_[size_] = t_max;
+        hit_[size_] = false;
+        active_ |= uint64_t( 1 ) << size_;
+        size_++;
+    }
+
+    // Call after the last add() and before testing boxes
+    void update_bounds();
+
+    int size() const
+    {
+        return size_;
+    }
+
+    const ray_t &ray( int i ) const
+    {
+        return rays_[i];
+    }
+
+    // Closest hit so far, or the initial t_max
+    double t_max( int i ) const
+    {
+        return t_max_[i];
+    }
+
+    // Largest t_max of all rays, boxes beyond it cannot hold a closer hit for any of them
+    double max_t_max() const
+    {
+        return *std::max_element( t_max_, t_max_ + size_ );
+    }
+
+    bool hit( int i ) const
+    {
+        return hit_[i];
+    }
+
+    const hit_record_t &record( int i ) const
+    {
+        return records_[i];
+    }
+
+    void set_hit( int i, const hit_record_t &rec )
+    {
+        records_[i] = rec;
+        t_max_[i] = rec.t;
+        hit_[i] = true;
+    }
+
+    // Bit i set for rays that may still hit what is being traversed
+    uint64_t active() const
+    {
+        return active_;
+    }
+
+    void set_active( uint64_t active )
+    {
+        active_ = active;
+    }
+
+    // Calls f( i ) for every active ray
+    template <typename f_t>
+    void for_each_active( f_t &&f ) const
+    {
+        for( uint64_t mask = active_; mask != 0; mask &= mask - 1 )
+            f( count_trailing_zeros( mask ) );
+    }
+
+    // Direction sign on axis shared by all rays, 1 or -1, 0 when they disagree
+    int direction_sign( int a ) const
+    {
+        return sign[a];
+    }
+
+    // False when no ray of the packet can enter the box between t_min and t_max
+    bool may_hit( const float min[3], const float max[3], double t_min, double t_max ) const;
+
+    bool may_hit( const aabb_t &box, double t_min, double t_max ) const
+    {
+        const float min[3] = { float_below( box.min.x ), float_below( box.min.y ), float_below( box.min.z ) };
+        const float max[3] = { float_above( box.max.x ), float_above( box.max.y ), float_above( box.max.z ) };
+        return may_hit( min, max, t_min, t_max );
+    }
+
+    // Whether ray i enters the box between t_min and its t_max
+    bool ray_may_hit( int i, const float min[3], const float max[3], double t_min ) const;
+
+    // The rays of mask that enter the box
+    uint64_t rays_may_hit( uint64_t mask, const float min[3], const float max[3], double t_min ) const
+    {
+        uint64_t result = 0;
+        for( ; mask != 0; mask &= mask - 1 )
+        {
+            const int i = count_trailing_zeros( mask );
+            if( ray_may_hit( i, min, max, t_min ) )
+                result |= uint64_t( 1 ) << i;
+        }
+        return result;
+    }
+
+    // The rays of mask from the first one that enters the box on, cheaper than rays_may_hit when most rays do
+    uint64_t first_may_hit( uint64_t mask, const float min[3], const float max[3], double t_min ) const
+    {
+        for( ; mask != 0; mask &= mask - 1 )
+        {
+            if( ray_may_hit( count_trailing_zeros( mask ), min, max, t_min ) )
+                return mask;
+        }
+        return 0;
+    }
+
+private:
+    static int count_trailing_zeros( uint64_t mask )
+    {
+        return __builtin_ctzll( mask );
+    }
+
+    static float float_below( double v )
+    {
+        const float f = static_cast<float>( v );
+        return f > v ? std::nextafter( f, -std::numeric_limits<float>::infinity() ) : f;
+    }
+
+    static float float_above( double v )
+    {
+        const float f = static_cast<float>( v );
+        return f < v ? std::nextafter( f, std::numeric_limits<float>::infinity() ) : f;
+    }
+
+    // Bounds of ( plane - origin ) * inv_direction over all rays, the inverse direction interval has one sign
+    void t_range( int a, double plane, double &lo, double &hi ) const
+    {
+        const double p[4] = { ( plane - origin_max[a] ) * inv_min[a],
+                              ( plane - origin_max[a] ) * inv_max[a],
+                              ( plane - origin_min[a] ) * inv_min[a],
+                              ( plane - origin_min[a] ) * inv_max[a] };
+        lo = std::min( std::min( p[0], p[1] ), std::min( p[2], p[3] ) );
+        hi = std::max( std::max( p[0], p[1] ), std::max( p[2], p[3] ) );
+    }
+
+private:
+    ray_t rays_[max_size];
+    double origins[max_size][3];
+    double inv_directions[max_size][3];
+    double t_max_[max_size];
+    bool hit_[max_size];
+    hit_record_t records_[max_size];
+    int size_{ 0 };
+    uint64_t active_{ 0 };
+
+    double origin_min[3];
+    double origin_max[3];
+    double inv_min[3];
+    double inv_max[3];
+    int sign[3];
+};
+
+inline void ray_packet_t::update_bounds()
+{
+    for( int a = 0; a < 3; a++ )
+    {
+        origin_min[a] = infinity;
+        origin_max[a] = -infinity;
+        inv_min[a] = infinity;
+        inv_max[a] = -infinity;
+        int positive = 0;
+        int negative = 0;
+
+        for( int i = 0; i < size_; i++ )
+        {
+            const double o = axis( rays_[i].origin(), a );
+            const double d = axis( rays_[i].direction(), a );
+            origin_min[a] = std::min( origin_min[a], o );
+            origin_max[a] = std::max( origin_max[a], o );
+
+            const double inv = 1.0 / d;
+            origins[i][a] = o;
+            inv_directions[i][a] = inv;
+            inv_min[a] = std::min( inv_min[a], inv );
+            inv_max[a] = std::max( inv_max[a], inv );
+            positive += d > 0.0;
+            negative += d < 0.0;
+        }
+
+        // Axes on which the rays point both ways, or along which some ray does not move, cannot bound t
+        const bool finite = std::isfinite( inv_min[a] ) && std::isfinite( inv_max[a] );
+        sign[a] = !finite ? 0 : ( positive == size_ ? 1 : ( negative == size_ ? -1 : 0 ) );
+    }
+}
+
+inline bool ray_packet_t::may_hit( const float min[3], const float max[3], double t_min, double t_max ) const
+{
+    // Every ray's entry is at least the largest lower bound of the slab entries, its exit at most the smallest
+    // upper bound of the slab exits
+    for( int a = 0; a < 3; a++ )
+    {
+        // Rays pointing both ways on this axis give no bound on t
+        if( sign[a] == 0 )
+            continue;
+
+        double near_lo, near_hi, far_lo, far_hi;
+        t_range( a, sign[a] > 0 ? min[a] : max[a], near_lo, near_hi );
+        t_range( a, sign[a] > 0 ? max[a] : min[a], far_lo, far_hi );
+
+        t_min = std::max( t_min, near_lo );
+        t_max = std::min( t_max, far_hi );
+        if( t_max < t_min )
+            return false;
+    }
+    return true;
+}
+
+inline bool ray_packet_t::ray_may_hit( int i, const float min[3], const float max[3], double t_min ) const
+{
+    double t_max = t_max_[i];
+    for( int a = 0; a < 3; a++ )
+    {
+        const double inv = inv_directions[i][a];
+        double t0 = ( min[a] - origins[i][a] ) * inv;
+        double t1 = ( max[a] - origins[i][a] ) * inv;
+        if( inv < 0.0 )
+            std::swap( t0, t1 );
+
+        // Written so that NaN from 0 * inf leaves the interval unchanged
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if( t_max < t_min )
+            return false;
+    }
+    return true;
+}
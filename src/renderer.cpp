@@ -0,0 +1,681 @@
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <thread>
+
+#include "renderer.hpp"
+#include "material.hpp"
+#include "perf_counters.hpp"
+#include "trace.hpp"
+
+namespace
+{
+    thread_local uint64_t thread_rays_traced = 0;
+
+    thread_local path_footprint_t *active_footprint = nullptr;
+
+    // r traced to rec, or to infinity for a ray that hit nothing
+    void record_hit( const ray_t &r, const hit_record_t &rec )
+    {
+        if( active_footprint )
+        {
+            active_footprint->add_hit( rec.object );
+            active_footprint->add_segment( r, 0.0, rec.t );
+        }
+    }
+
+    void record_miss( const ray_t &r )
+    {
+        if( active_footprint )
+            active_footprint->add_segment( r, 0.0, infinity );
+    }
+
+    double luminance( const color_t &c )
+    {
+        return 0.2126 * c.x + 0.7152 * c.y + 0.0722 * c.z;
+    }
+
+    double milliseconds_between( std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to )
+    {
+        return std::chrono::duration<double, std::milli>( to - from ).count();
+    }
+
+    color_t path_color( Job &job, const ray_t &r, int max_depth )
+    {
+        if( job.lights )
+            return ray_color_lights( r, *job.world, *job.lights, job.sample_lights, max_depth, 0.0, job.rng );
+        return ray_color( job.col, job.row, r, *job.world, max_depth, job.rng );
+    }
+} // namespace
+
+uint64_t rays_traced_by_thread()
+{
+    return thread_rays_traced;
+}
+
+path_record_scope_t::path_record_scope_t( path_footprint_t &footprint )
+{
+    active_footprint = &footprint;
+}
+
+path_record_scope_t::~path_record_scope_t()
+{
+    active_footprint = nullptr;
+}
+
+namespace
+{
+    color_t sky_color( const ray_t &r )
+    {
+        const vec3_t unit_direction = unit_vector( r.direction() );
+        const auto t = 0.5 * ( unit_direction.y + 1.0 );
+        constexpr color_t white = color_t{ 1.0, 1.0, 1.0 };
+        constexpr color_t blue = color_t{ 0.5, 0.7, 1.0 };
+        return white * ( 1.0 - t ) + blue * t;
+    }
+
+    // ray_color once r has been traced to rec
+    color_t hit_color( int col,
+                       int row,
+                       const ray_t &r,
+                       const hit_record_t &rec,
+                       const hittable_t &world,
+                       int depth,
+                       random_number_generator_t &rng )
+    {
+        record_hit( r, rec );
+
+        ray_t scattered;
+        color_t attenuation;
+        if( rec.material->scatter( r, rec, rng, attenuation, scattered ) )
+        {
+            auto recursed_color = ray_color( col, row, scattered, world, depth - 1, rng );
+            // std::cerr << "> Scatter " << col << ' ' << row << " dir=" << r.direction()
+            //           << " attenuation=" << attenuation << " recursed_color=" << recursed_color
+            //           << " out=" << ( attenuation * recursed_color ) << '\n';
+            return attenuation * recursed_color;
+        }
+
+        // std::cerr << "> Diffuse " << col << ' ' << row << " = " << rec.material->diffuse() << '\n';
+        return rec.material->diffuse();
+    }
+
+    // ray_color_lights once r has been traced to rec
+    color_t hit_color_lights( const ray_t &r,
+                              const hit_record_t &rec,
+                              const hittable_t &world,
+                              const light_list_t &lights,
+                              bool sample_lights,
+                              int depth,
+                              double bsdf_pdf,
+                              random_number_generator_t &rng )
+    {
+        record_hit( r, rec );
+
+        color_t color = rec.material->emitted( rec );
+        if( bsdf_pdf > 0.0 && sample_lights && !near_zero( color ) )
+        {
+            // The light sample at the previous hit could have found this light as well
+            const double light_pdf = lights.pdf_value( rec.object, r.origin(), r.direction() );
+            color = color * ( bsdf_pdf * bsdf_pdf / ( bsdf_pdf * bsdf_pdf + light_pdf * light_pdf ) );
+        }
+
+        ray_t scattered;
+        color_t attenuation;
+        if( !rec.material->scatter( r, rec, rng, attenuation, scattered ) )
+            return color;
+
+        double scattered_pdf = 0.0;
+        if( !rec.material->is_specular() && sample_lights )
+        {
+            double probability;
+            const hittable_t *light = lights.sample( rng, probability );
+            const vec3_t direction = light->random_direction( rec.p, rng );
+            const double light_pdf = probability * light->pdf_value( rec.p, direction );
+            const color_t f = rec.material->eval( rec, direction );
+
+            hit_record_t light_rec;
+            const ray_t shadow_ray( rec.p, direction );
+            if( light_pdf > 0.0 && !near_zero( f ) && light->hit( shadow_ray, 0.001, infinity, light_rec ) )
+            {
+                const color_t emitted = light_rec.material->emitted( light_rec );
+                thread_rays_traced++;
+                if( active_footprint && !near_zero( emitted ) )
+                    active_footprint->add_segment( shadow_ray, 0.0, light_rec.t ); // anything moved into it blocks it
+                if( !near_zero( emitted ) && !world.hit_any( shadow_ray, 0.001, light_rec.t * ( 1.0 - 1e-6 ) ) )
+                {
+                    const double pdf = rec.material->pdf( rec, direction );
+                    const double weight = light_pdf * light_pdf / ( light_pdf * light_pdf + pdf * pdf );
+                    color += f * emitted * ( weight / light_pdf );
+                }
+            }
+
+            scattered_pdf = rec.material->pdf( rec, scattered.direction() );
+        }
+
+        return color
+               + attenuation
+                     * ray_color_lights( scattered, world, lights, sample_lights, depth - 1, scattered_pdf, rng );
+    }
+
+    // path_color for the camera ray packet.ray( i ) after the packet was traced
+    color_t packet_path_color( Job &job, const ray_packet_t &packet, int i )
+    {
+        const ray_t &r = packet.ray( i );
+        if( job.max_depth <= 0 )
+            return path_color( job, r, job.max_depth );
+
+        thread_rays_traced++;
+
+        if( !packet.hit( i ) )
+            record_miss( r );
+
+        if( job.lights )
+        {
+            if( !packet.hit( i ) )
+                return color_t{ 0.0, 0.0, 0.0 };
+            return hit_color_lights(
+                r, packet.record( i ), *job.world, *job.lights, job.sample_lights, job.max_depth, 0.0, job.rng );
+        }
+
+        if( !packet.hit( i ) )
+            return sky_color( r );
+        return hit_color( job.col, job.row, r, packet.record( i ), *job.world, job.max_depth, job.rng );
+    }
+} // namespace
+
+color_t
+ray_color( int col, int row, const ray_t &r, const hittable_t &world, int depth, random_number_generator_t &rng )
+{
+    if( depth <= 0 )
+        return color_t{ 1.0, 1.0, 1.0 };
+
+    thread_rays_traced++;
+
+    hit_record_t rec;
+    if( world.hit( r, 0.001, infinity, rec ) )
+        return hit_color( col, row, r, rec, world, depth, rng );
+
+    record_miss( r );
+    auto sky = sky_color( r );
+
+    // std::cerr << "> Sky " << col << ' ' << row << " = " << sky << '\n';
+
+    return sky;
+}
+
+color_t ray_color_lights( const ray_t &r,
+                          const hittable_t &world,
+                          const light_list_t &lights,
+                          bool sample_lights,
+                          int depth,
+                          double bsdf_pdf,
+                          random_number_generator_t &rng )
+{
+    constexpr color_t black = color_t{ 0.0, 0.0, 0.0 };
+
+    if( depth <= 0 )
+        return black;
+
+    thread_rays_traced++;
+
+    hit_record_t rec;
+    if( !world.hit( r, 0.001, infinity, rec ) )
+    {
+        record_miss( r );
+        return black;
+    }
+
+    return hit_color_lights( r, rec, world, lights, sample_lights, depth, bsdf_pdf, rng );
+}
+
+color_t render_job( Job &job )
+{
+    int samples_per_pixel = job.samples_per_pixel_x * job.samples_per_pixel_y;
+
+    color_t color = color_t{ 0.0, 0.0, 0.0 };
+
+    for( int sample_y = 0; sample_y < job.samples_per_pixel_y; sample_y++ )
+    {
+        double y = double( sample_y ) / job.samples_per_pixel_y - 0.5;
+        double v = ( job.row + y ) / ( job.image_height - 1 );
+
+        for( int sample_x = 0; sample_x < job.samples_per_pixel_x; sample_x++ )
+        {
+            // std::cerr << "Job " << job.col << ' ' << job.row << ", sample " << sample_x << ' ' << sample_y << '\n';
+
+            double x = double( sample_x ) / job.samples_per_pixel_x - 0.5;
+            double u = ( job.col + x ) / ( job.image_width - 1 );
+            const ray_t r = job.cam->get_ray( job.rng, u, v );
+            color += path_color( job, r, job.max_depth );
+        }
+    }
+
+    return color;
+}
+
+color_t render_sample( Job &job, int sample_index, int max_depth )
+{
+    const int sample_x = sample_index % job.samples_per_pixel_x;
+    const int sample_y = sample_index / job.samples_per_pixel_x;
+
+    const double x = double( sample_x ) / job.samples_per_pixel_x - 0.5;
+    const double y = double( sample_y ) / job.samples_per_pixel_y - 0.5;
+    const double u = ( job.col + x ) / ( job.image_width - 1 );
+    const double v = ( job.row + y ) / ( job.image_height - 1 );
+    const ray_t r = job.cam->get_ray( job.rng, u, v );
+    return path_color( job, r, max_depth );
+}
+
+void render_packet( const std::vector<Job *> &jobs )
+{
+    if( jobs.empty() )
+        return;
+
+    // The jobs only differ in their pixel and random state
+    const Job &first = *jobs.front();
+    ray_packet_t packet;
+
+    for( Job *job : jobs )
+        job->color = color_t{ 0.0, 0.0, 0.0 };
+
+    for( int sample_y = 0; sample_y < first.samples_per_pixel_y; sample_y++ )
+    {
+        double y = double( sample_y ) / first.samples_per_pixel_y - 0.5;
+
+        for( int sample_x = 0; sample_x < first.samples_per_pixel_x; sample_x++ )
+        {
+            double x = double( sample_x ) / first.samples_per_pixel_x - 0.5;
+
+            packet.clear();
+            for( Job *job : jobs )
+            {
+                double u = ( job->col + x ) / ( job->image_width - 1 );
+                double v = ( job->row + y ) / ( job->image_height - 1 );
+                packet.add( job->cam->get_ray( job->rng, u, v ), infinity );
+            }
+
+            if( first.max_depth > 0 )
+            {
+                packet.update_bounds();
+                first.world->hit_packet( packet, 0.001 );
+            }
+
+            for( int i = 0; i < packet.size(); i++ )
+                jobs[i]->color += packet_path_color( *jobs[i], packet, i );
+        }
+    }
+}
+
+void render_rect( std::vector<Job> &jobs, int image_width, int x0, int y0, int x1, int y1, int block_size )
+{
+    block_size = std::clamp( block_size, 1, packet_size );
+
+    std::vector<Job *> block;
+    block.reserve( block_size * block_size );
+
+    for( int block_y = y0; block_y < y1; block_y += block_size )
+    {
+        for( int block_x = x0; block_x < x1; block_x += block_size )
+        {
+            block.clear();
+            for( int row = block_y; row < std::min( block_y + block_size, y1 ); row++ )
+            {
+                for( int col = block_x; col < std::min( block_x + block_size, x1 ); col++ )
+                    block.push_back( &jobs[row * image_width + col] );
+            }
+            render_packet( block );
+        }
+    }
+}
+
+int band_rows( const render_settings_t &settings )
+{
+    return std::max( 1, settings.tile_rows / packet_size ) * packet_size;
+}
+
+std::vector<Job> create_jobs( const render_settings_t &settings, const scene_t &scene, const camera_t &cam )
+{
+    TRACE_SCOPE( "create_jobs" );
+    PERF_PHASE( "create_jobs" );
+
+    std::vector<Job> jobs;
+    jobs.reserve( settings.image_width * settings.image_height );
+
+    for( int row = 0; row < settings.image_height; row++ )
+    {
+        // std::cerr << "Creating jobs for line: " << row << "    \r";
+
+        for( int col = 0; col < settings.image_width; col++ )
+        {
+            Job job;
+
+            job.rng = scene.rng.clone();
+            job.row = row;
+            job.col = col;
+            job.world = &scene.world;
+            job.lights = scene.lights.empty() ? nullptr : &scene.lights;
+            job.sample_lights = settings.sample_lights;
+            job.cam = &cam;
+            job.image_width = settings.image_width;
+            job.image_height = settings.image_height;
+            job.samples_per_pixel_x = settings.samples_per_pixel_x;
+            job.samples_per_pixel_y = settings.samples_per_pixel_y;
+            job.max_depth = settings.max_depth;
+
+            jobs.push_back( job );
+        }
+    }
+
+    return jobs;
+}
+
+void render( thread_pool_t &pool,
+             const render_settings_t &settings,
+             std::vector<Job> &jobs,
+             image_t &pixel,
+             bool report_progress,
+             const numa_placement_t &placement,
+             std::vector<node_report_t> *nodes )
+{
+    TRACE_SCOPE( "render" );
+    PERF_PHASE( "render" );
+
+    using clock = std::chrono::steady_clock;
+
+    const int image_width = settings.image_width;
+    const int image_height = settings.image_height;
+    std::atomic<int> remaining_lines{ image_height };
+    std::mutex progress_mutex;
+
+    const int node_count = std::max( cpu_topology_t::machine().node_count(),
+                                     static_cast<int>( placement.replicas.size() ) );
+    std::vector<node_report_t> node_reports( node_count );
+    std::vector<std::set<std::thread::id>> node_threads( node_count );
+
+    const int tile_rows = band_rows( settings );
+
+    // One task per band of tile_rows rows, rendered in packets of packet_width x packet_width pixels
+    std::vector<thread_pool_t::task_t> tasks;
+    tasks.reserve( ( image_height + tile_rows - 1 ) / tile_rows );
+
+    for( int band = 0; band < image_height; band += tile_rows )
+    {
+        tasks.emplace_back(
+            [&, band]
+            {
+                TRACE_SCOPE_ARG( "render_band", band );
+                PERF_TILE( "render_band", band );
+
+                const auto start = clock::now();
+                const uint64_t rays_before = rays_traced_by_thread();
+                const int node = std::min( thread_pool_t::worker_node(), node_count - 1 );
+                const int band_end = std::min( band + tile_rows, image_height );
+
+                // Rows left empty for first touch get a copy of their jobs made here too, as every sample writes
+                // to a job's color and random state
+                std::vector<Job> band_jobs;
+                const bool local_jobs = pixel[band].empty();
+                if( local_jobs )
+                    band_jobs.assign( jobs.begin() + band * image_width, jobs.begin() + band_end * image_width );
+                std::vector<Job> &source = local_jobs ? band_jobs : jobs;
+                const int first_row = local_jobs ? band : 0; // row of source[0]
+                const int top = band - first_row;
+                const int bottom = band_end - first_row;
+
+                if( !placement.replicas.empty() )
+                {
+                    const scene_t &replica = *placement.replicas[node % placement.replicas.size()];
+                    for( int i = top * image_width; i < bottom * image_width; i++ )
+                    {
+                        source[i].world = &replica.world;
+                        source[i].lights = replica.lights.empty() ? nullptr : &replica.lights;
+                    }
+                }
+
+                render_rect( source, image_width, 0, top, image_width, bottom, settings.packet_width );
+
+                for( int row = band; row < band_end; row++ )
+                {
+                    if( pixel[row].empty() )
+                        pixel[row].resize( image_width );
+                    for( int col = 0; col < image_width; col++ )
+                        pixel[row][col] = source[( row - first_row ) * image_width + col].color;
+                }
+
+                const int remaining = remaining_lines -= band_end - band;
+                std::lock_guard<std::mutex> lock( progress_mutex );
+                node_report_t &report = node_reports[node];
+                report.bands++;
+                report.rays += rays_traced_by_thread() - rays_before;
+                report.busy_ms += milliseconds_between( start, clock::now() );
+                node_threads[node].insert( std::this_thread::get_id() );
+                if( report_progress )
+                    std::cerr << "Lines remaining: " << remaining << "    \r";
+            } );
+    }
+
+    pool.run( std::move( tasks ) );
+
+    if( report_progress )
+        std::cerr << "Lines remaining: 0    \n";
+
+    if( nodes )
+    {
+        for( int node = 0; node < node_count; node++ )
+            node_reports[node].threads = static_cast<unsigned>( node_threads[node].size() );
+        *nodes = std::move( node_reports );
+    }
+}
+
+accumulation_buffer_t::accumulation_buffer_t( int width, int height )
+    : color( height, std::vector<color_t>( width, color_t{} ) ),
+      luminance_squared( height, std::vector<double>( width, 0.0 ) ),
+      row_samples( height, 0 )
+{
+}
+
+budget_report_t render_within_budget( thread_pool_t &pool,
+                                      const render_settings_t &settings,
+                                      std::vector<Job> &jobs,
+                                      accumulation_buffer_t &accumulation,
+                                      std::chrono::steady_clock::time_point deadline )
+{
+    using clock = std::chrono::steady_clock;
+
+    constexpr int calibration_rows = 16;
+    constexpr double calibration_share = 0.1; // of the whole budget
+    constexpr int min_affordable_samples = 2;
+    constexpr int coarse_depth = 4; // when the budget ran out before calibration measured anything
+
+    const auto start = clock::now();
+    const int image_width = settings.image_width;
+    const int image_height = settings.image_height;
+    const int target_samples = settings.samples_per_pixel_x * settings.samples_per_pixel_y;
+
+    budget_report_t report;
+    TRACE_SCOPE( "render_within_budget" );
+    PERF_PHASE( "render_within_budget" );
+
+    // Calibration: one sample at full depth for every pixel of a few evenly spaced rows, on copies of the jobs so
+    // the real passes see the same random sequence. Records how many rays each path needed.
+    const auto calibration_deadline = start + ( deadline - start ) * calibration_share;
+    const int stride = std::max( 1, image_height / calibration_rows );
+
+    std::vector<std::vector<int>> path_lengths( image_height );
+    std::vector<thread_pool_t::task_t> tasks;
+    for( int row = 0; row < image_height; row += stride )
+    {
+        tasks.emplace_back(
+            [&, row]
+            {
+                if( clock::now() > calibration_deadline )
+                    return;
+
+                TRACE_SCOPE_ARG( "calibrate_row", row );
+                PERF_TILE( "calibrate_row", row );
+
+                for( int col = 0; col < image_width; col++ )
+                {
+                    Job job = jobs[row * image_width + col];
+                    const uint64_t before = rays_traced_by_thread();
+                    (void)render_sample( job, 0, settings.max_depth );
+                    path_lengths[row].push_back( static_cast<int>( rays_traced_by_thread() - before ) );
+                }
+            } );
+    }
+    pool.run( std::move( tasks ) );
+
+    const auto calibrated = clock::now();
+    report.calibration_ms = milliseconds_between( start, calibrated );
+
+    std::vector<int> lengths;
+    for( const auto &row_lengths : path_lengths )
+        lengths.insert( lengths.end(), row_lengths.begin(), row_lengths.end() );
+
+    uint64_t calibration_rays = 0;
+    for( const int length : lengths )
+        calibration_rays += length;
+
+    // Pick the largest depth at which the remaining budget still buys a few samples per pixel
+    report.max_depth = calibration_rays > 0 ? settings.max_depth : std::min( settings.max_depth, coarse_depth );
+    if( calibration_rays > 0 && report.calibration_ms > 0.0 )
+    {
+        report.rays_per_second = calibration_rays / ( report.calibration_ms / 1000.0 );
+
+        const double remaining_seconds = std::max( 0.0, milliseconds_between( calibrated, deadline ) / 1000.0 );
+        const int wanted_samples = std::min( min_affordable_samples, target_samples );
+
+        for( int depth = settings.max_depth; depth >= 1; depth-- )
+        {
+            uint64_t rays = 0;
+            for( const int length : lengths )
+                rays += std::min( length, depth );
+
+            const double rays_per_pass = double( rays ) / lengths.size() * image_width * image_height;
+            const double seconds_per_pass = rays_per_pass / report.rays_per_second;
+
+            report.max_depth = depth;
+            if( remaining_seconds >= wanted_samples * seconds_per_pass )
+                break;
+        }
+    }
+
+    // Pass k renders sample stratum ( k * order_step ) mod target_samples, with a step coprime to the number of
+    // strata so that every stratum is visited once and consecutive passes land far apart in the pixel
+    int order_step = std::max( 1, static_cast<int>( target_samples * 0.618 ) );
+    while( std::gcd( order_step, target_samples ) != 1 )
+        order_step--;
+
+    // Progressive passes, a pass is only started if the previous one suggests it will finish in time. The first
+    // pass always covers every row, even past the deadline, so there is an image to return.
+    double last_pass_ms = 0.0;
+    while( report.passes < target_samples )
+    {
+        const auto pass_start = clock::now();
+        const bool first_pass = report.passes == 0;
+        if( !first_pass && ( milliseconds_between( pass_start, deadline ) < last_pass_ms || pass_start >= deadline ) )
+            break;
+
+        const int sample_index = static_cast<int>( int64_t( report.passes ) * order_step % target_samples );
+
+        tasks.clear();
+        for( int row = 0; row < image_height; row++ )
+        {
+            tasks.emplace_back(
+                [&, row, first_pass]
+                {
+                    if( !first_pass && clock::now() > deadline )
+                        return;
+
+                    TRACE_SCOPE_ARG( "render_row", row );
+                    PERF_TILE( "render_row", row );
+
+                    for( int col = 0; col < image_width; col++ )
+                    {
+                        const color_t c
+                            = render_sample( jobs[row * image_width + col], sample_index, report.max_depth );
+                        const double l = luminance( c );
+                        accumulation.color[row][col] += c;
+                        accumulation.luminance_squared[row][col] += l * l;
+                    }
+                    accumulation.row_samples[row]++;
+                } );
+        }
+        {
+            TRACE_SCOPE_ARG( "pass", report.passes );
+            pool.run( std::move( tasks ) );
+        }
+
+        const auto pass_end = clock::now();
+        if( first_pass && pass_end > deadline )
+            report.overrun_ms = milliseconds_between( deadline, pass_end );
+
+        report.passes++;
+        last_pass_ms = milliseconds_between( pass_start, pass_end );
+    }
+
+    report.render_ms = milliseconds_between( start, clock::now() );
+
+    const auto samples = std::minmax_element( accumulation.row_samples.begin(), accumulation.row_samples.end() );
+    report.min_samples = *samples.first;
+    report.max_samples = *samples.second;
+
+    double error_sum = 0.0;
+    double luminance_sum = 0.0;
+    int measured = 0;
+    for( int row = 0; row < image_height; row++ )
+    {
+        const int n = accumulation.row_samples[row];
+        if( n < 2 )
+            continue;
+
+        for( int col = 0; col < image_width; col++ )
+        {
+            const double mean = luminance( accumulation.color[row][col] ) / n;
+            const double variance = std::max( 0.0, ( accumulation.luminance_squared[row][col] / n - mean * mean ) )
+                                    * n / ( n - 1 );
+            error_sum += std::sqrt( variance / n );
+            luminance_sum += mean;
+            measured++;
+        }
+    }
+    if( measured > 0 && luminance_sum > 0.0 )
+        report.relative_error = error_sum / luminance_sum;
+
+    return report;
+}
+
+void write_image( std::ostream &out, const render_settings_t &settings, const image_t &pixel )
+{
+    TRACE_SCOPE( "write_image" );
+
+    out << "P3\n" << settings.image_width << ' ' << settings.image_height << "\n255\n";
+    for( int row = settings.image_height - 1; row >= 0; row-- )
+    {
+        for( int col = 0; col < settings.image_width; col++ )
+        {
+            write_color( out, pixel[row][col], settings.samples_per_pixel_x * settings.samples_per_pixel_y );
+        }
+    }
+}
+
+void write_image( std::ostream &out, const accumulation_buffer_t &accumulation )
+{
+    TRACE_SCOPE( "write_image" );
+
+    const int image_height = static_cast<int>( accumulation.color.size() );
+    const int image_width = image_height > 0 ? static_cast<int>( accumulation.color[0].size() ) : 0;
+
+    out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+    for( int row = image_height - 1; row >= 0; row-- )
+    {
+        for( int col = 0; col < image_width; col++ )
+        {
+            write_color( out, accumulation.color[row][col], std::max( 1, accumulation.row_samples[row] ) );
+        }
+    }
+}
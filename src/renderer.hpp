@@ -0,0 +1,173 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "vec3.hpp"
+#include "ray.hpp"
+#include "ray_packet.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "camera.hpp"
+#include "light_list.hpp"
+#include "path_footprint.hpp"
+#include "scene.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+
+// Camera rays are traced in packets of at most packet_size x packet_size pixels
+constexpr int packet_size = 8;
+static_assert( packet_size * packet_size <= ray_packet_t::max_size, "a block of pixels must fit in one ray packet" );
+
+class render_settings_t
+{
+public:
+    int image_width{ 192 };
+    int image_height{ 120 };
+    int samples_per_pixel_x{ 16 };
+    int samples_per_pixel_y{ 16 };
+    int max_depth{ 50 };
+    bool sample_lights{ true }; // next event estimation in scenes with lights, pure path tracing when false
+    int tile_rows{ packet_size };    // rows per task of render, a multiple of packet_size
+    int packet_width{ packet_size }; // render traces camera rays in blocks of this many pixels squared
+};
+
+struct Job
+{
+    color_t color; // result of render_packet
+    random_number_generator_t rng;
+    int row;
+    int col;
+    const hittable_list_t *world;
+    const light_list_t *lights; // nullptr for scenes lit by the sky
+    bool sample_lights;
+    const camera_t *cam;
+    int image_width;
+    int image_height;
+    int samples_per_pixel_x;
+    int samples_per_pixel_y;
+    int max_depth;
+};
+
+using image_t = std::vector<std::vector<color_t>>;
+
+// While alive, adds every path segment and shadow ray traced on this thread to footprint
+class path_record_scope_t
+{
+public:
+    explicit path_record_scope_t( path_footprint_t &footprint );
+    ~path_record_scope_t();
+
+    path_record_scope_t( const path_record_scope_t & ) = delete;
+    path_record_scope_t &operator=( const path_record_scope_t & ) = delete;
+};
+
+// Running sums for progressive rendering, every pixel of a row has the same number of samples
+class accumulation_buffer_t
+{
+public:
+    accumulation_buffer_t( int width, int height );
+
+    image_t color;
+    std::vector<std::vector<double>> luminance_squared;
+    std::vector<int> row_samples;
+};
+
+// What render_within_budget managed to do before its deadline
+class budget_report_t
+{
+public:
+    int passes{ 0 };
+    int min_samples{ 0 };
+    int max_samples{ 0 };
+    int max_depth{ 0 };
+    double calibration_ms{ 0.0 };
+    double render_ms{ 0.0 };
+    double rays_per_second{ 0.0 };
+    double relative_error{ 0.0 }; // mean standard error of pixel luminance over mean luminance
+    double overrun_ms{ 0.0 };     // how late the first pass finished, 0 when it met the deadline
+};
+
+// Where the bands of a render read the scene from on a NUMA machine
+class numa_placement_t
+{
+public:
+    // Indexed by node, each built from the same scene description by a thread on that node. Bands read the replica
+    // of the node their worker runs on. Empty to use the scene the jobs were created for.
+    std::vector<std::shared_ptr<const scene_t>> replicas;
+};
+
+// What the workers of one NUMA node contributed to a render
+class node_report_t
+{
+public:
+    unsigned threads{ 0 };
+    uint64_t bands{ 0 };
+    uint64_t rays{ 0 };
+    double busy_ms{ 0.0 }; // summed over its threads
+};
+
+[[nodiscard]] color_t
+ray_color( int col, int row, const ray_t &r, const hittable_t &world, int depth, random_number_generator_t &rng );
+
+// Scenes with lights: emission plus light samples at diffuse hits, combined with BSDF sampling by the power
+// heuristic. bsdf_pdf is the density with which the previous bounce chose r, 0 after specular bounces and for
+// camera rays. Rays that leave the scene see black instead of the sky.
+[[nodiscard]] color_t ray_color_lights( const ray_t &r,
+                                        const hittable_t &world,
+                                        const light_list_t &lights,
+                                        bool sample_lights,
+                                        int depth,
+                                        double bsdf_pdf,
+                                        random_number_generator_t &rng );
+
+[[nodiscard]] color_t render_job( Job &job );
+
+// The sample of render_job's samples_per_pixel_x * samples_per_pixel_y grid with the given index
+[[nodiscard]] color_t render_sample( Job &job, int sample_index, int max_depth );
+
+// Renders every job like render_job into its color, one sample of all jobs at a time: the camera rays are traced
+// as one packet to their first hit, then each path continues on its own. At most ray_packet_t::max_size jobs of
+// one scene, sharing camera and sample grid, and best a compact block of pixels.
+void render_packet( const std::vector<Job *> &jobs );
+
+// Rows of one render task: tile_rows rounded down to whole packets, at least one packet
+[[nodiscard]] int band_rows( const render_settings_t &settings );
+
+// render_packet for the pixels [x0, x1) x [y0, y1) of a row major job array, block by block
+void render_rect(
+    std::vector<Job> &jobs, int image_width, int x0, int y0, int x1, int y1, int block_size = packet_size );
+
+// Number of rays traced by the calling thread so far
+[[nodiscard]] uint64_t rays_traced_by_thread();
+
+[[nodiscard]] std::vector<Job>
+create_jobs( const render_settings_t &settings, const scene_t &scene, const camera_t &cam );
+
+// Renders one band of tile_rows rows of jobs per task on the pool, writing the summed samples into pixel[row][col].
+// Empty rows of pixel are allocated by the worker that renders them, so their memory is first touched on its node.
+// That worker also renders a copy of their jobs it allocates, which leaves the colors of those jobs in jobs unset.
+// With nodes, it is resized to the node count and receives what each node did.
+void render( thread_pool_t &pool,
+             const render_settings_t &settings,
+             std::vector<Job> &jobs,
+             image_t &pixel,
+             bool report_progress,
+             const numa_placement_t &placement = numa_placement_t{},
+             std::vector<node_report_t> *nodes = nullptr );
+
+// Calibrates throughput on a subset of rows, lowers max_depth if the budget cannot afford a few samples per pixel
+// at full depth, then adds one sample per pixel per pass until the deadline or samples_per_pixel_x * y is reached.
+// Rows that could not be started before the deadline keep the samples they have. The first pass always renders
+// every row, at low depth when calibration found no time left, and reports in overrun_ms when it ended late.
+budget_report_t render_within_budget( thread_pool_t &pool,
+                                      const render_settings_t &settings,
+                                      std::vector<Job> &jobs,
+                                      accumulation_buffer_t &accumulation,
+                                      std::chrono::steady_clock::time_point deadline );
+
+void write_image( std::ostream &out, const render_settings_t &settings, const image_t &pixel );
+void write_image( std::ostream &out, const accumulation_buffer_t &accumulation );
@@ -0,0 +1,686 @@
+#include "scene.hpp"
+#include "lambertian.hpp"
+#include "metal.hpp"
+#include "dielectric.hpp"
+#include "sphere.hpp"
+#include "parallelogram.hpp"
+#include "diffuse_light.hpp"
+#include "sphere_set.hpp"
+#include "instance_set.hpp"
+#include "texture.hpp"
+#include "perf_counters.hpp"
+#include "trace.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+hittable_list_t simple_scene( material_pool_t &materials )
+{
+    hittable_list_t world;
+
+    const auto ground_material = materials.make<lambertian_t>( color_t{ 0.5, 0.5, 0.5 } );
+    world.add( std::make_shared<sphere_t>( point3_t{ 0.0, -1000.0, 0.0 }, 1000, ground_material ) );
+
+    const auto material1 = materials.make<dielectric_t>( 1.5 );
+    world.add( std::make_shared<sphere_t>( point3_t{ 0, 1, 0 }, 1.0, material1 ) );
+
+    const auto material2 = materials.make<lambertian_t>( color_t{ 0.4, 0.2, 0.1 } );
+    world.add( std::make_shared<sphere_t>( point3_t{ -4, 1, 0 }, 1.0, material2 ) );
+
+    const auto material3 = materials.make<metal_t>( color_t{ 0.7, 0.6, 0.5 }, 0.0 );
+    world.add( std::make_shared<sphere_t>( point3_t{ 4, 1, 0 }, 1.0, material3 ) );
+
+    return world;
+}
+
+hittable_list_t random_scene( random_number_generator_t &rng, material_pool_t &materials )
+{
+    hittable_list_t world;
+
+    const auto ground_material = materials.make<lambertian_t>( color_t{ 0.5, 0.5, 0.5 } );
+    world.add( std::make_shared<sphere_t>( point3_t{ 0.0, -1000.0, 0.0 }, 1000, ground_material ) );
+
+    const auto world_center = point3_t{ 4, 0.2, 0 };
+    const auto radius = 0.2;
+
+    for( int a = -11; a < 11; a++ )
+    {
+        for( int b = -11; b < 11; b++ )
+        {
+            const point3_t sphere_center{ a + 0.9 * rng.random_double(), 0.2, b + 0.9 * rng.random_double() };
+
+            if( length( sphere_center - world_center ) > 0.9 )
+            {
+                const auto choose_mat = rng.random_double();
+                std::shared_ptr<material_t> material;
+                if( choose_mat < 0.8 )
+                {
+                    // diffuse
+                    const auto albedo = rng.random_vec3();
+                    material = materials.make<lambertian_t>( albedo );
+                }
+                else if( choose_mat < 0.95 )
+                {
+                    // metal_t
+                    const auto albedo = rng.random_vec3_range( 0.5, 1 );
+                    const auto fuzz = rng.random_range( 0, 0.5 );
+                    material = materials.make<metal_t>( albedo, fuzz );
+                }
+                else
+                {
+                    // glass
+                    material = materials.make<dielectric_t>( 1.5 );
+                }
+                world.add( std::make_shared<sphere_t>( sphere_center, radius, material ) );
+            }
+        }
+    }
+
+    const auto material1 = materials.make<dielectric_t>( 1.5 );
+    world.add( std::make_shared<sphere_t>( point3_t{ 0, 1, 0 }, 1.0, material1 ) );
+
+    const auto material2 = materials.make<lambertian_t>( color_t{ 0.4, 0.2, 0.1 } );
+    world.add( std::make_shared<sphere_t>( point3_t{ -4, 1, 0 }, 1.0, material2 ) );
+
+    const auto material3 = materials.make<metal_t>( color_t{ 0.7, 0.6, 0.5 }, 0.0 );
+    world.add( std::make_shared<sphere_t>( point3_t{ 4, 1, 0 }, 1.0, material3 ) );
+
+    return world;
+}
+
+namespace
+{
+    double milliseconds_since( std::chrono::steady_clock::time_point start )
+    {
+        return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+    }
+
+    // Counter based random numbers in [0, 1), so every sphere can be generated independently of the others.
+    // random_number_generator_t is a single sequential stream and repeats itself after a few hundred values.
+    double hashed_random( uint64_t seed, uint64_t index, uint64_t stream )
+    {
+        // splitmix64 finalizer
+        uint64_t z = seed * 0x9e3779b97f4a7c15ull + index * 0xbf58476d1ce4e5b9ull + stream * 0x94d049bb133111ebull;
+        z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ull;
+        z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebull;
+        z = z ^ ( z >> 31 );
+        return ( z >> 11 ) * ( 1.0 / 9007199254740992.0 );
+    }
+
+    bool parse_procedural_settings( const std::string &parameters, procedural_settings_t &settings )
+    {
+        std::istringstream in( parameters );
+        std::string pair;
+        while( std::getline( in, pair, ',' ) )
+        {
+            const auto eq = pair.find( '=' );
+            if( eq == std::string::npos )
+                return false;
+
+            const std::string key = pair.substr( 0, eq );
+            const std::string value = pair.substr( eq + 1 );
+            try
+            {
+                if( key == "count" )
+                {
+                    if( value.empty() || value.find_first_not_of( "0123456789" ) != std::string::npos )
+                        return false;
+                    settings.count = static_cast<size_t>( std::stoull( value ) );
+                }
+                else if( key == "extent" )
+                    settings.extent = std::stod( value );
+                else if( key == "seed" )
+                    settings.seed = std::stoull( value );
+                else if( key == "budget_mb" )
+                    settings.budget_mb = std::stod( value );
+                else if( key == "leaf" )
+                    settings.leaf_size = std::stoi( value );
+                else
+                    return false;
+            }
+            catch( const std::exception & )
+            {
+                return false;
+            }
+        }
+
+        return settings.count > 0 && settings.extent >= 0.0 && settings.leaf_size > 0;
+    }
+
+    bool parse_textured_settings( const std::string &parameters, textured_settings_t &settings )
+    {
+        std::istringstream in( parameters );
+        std::string pair;
+        while( std::getline( in, pair, ',' ) )
+        {
+            const auto eq = pair.find( '=' );
+            if( eq == std::string::npos )
+                return false;
+
+            const std::string key = pair.substr( 0, eq );
+            const std::string value = pair.substr( eq + 1 );
+            try
+            {
+                if( key == "texture" )
+                    settings.textures.push_back( value );
+                else if( key == "count" )
+                {
+                    if( value.empty() || value.find_first_not_of( "0123456789" ) != std::string::npos )
+                        return false;
+                    settings.count = static_cast<size_t>( std::stoull( value ) );
+                }
+                else if( key == "cache_mb" )
+                    settings.cache_mb = std::stod( value );
+                else if( key == "tile" )
+                    settings.tile_size = std::stoi( value );
+                else
+                    return false;
+            }
+            catch( const std::exception & )
+            {
+                return false;
+            }
+        }
+
+        return !settings.textures.empty() && settings.count > 0 && settings.cache_mb > 0.0 && settings.tile_size > 0;
+    }
+
+    bool parse_forest_settings( const std::string &parameters, forest_settings_t &settings )
+    {
+        std::istringstream in( parameters );
+        std::string pair;
+        while( std::getline( in, pair, ',' ) )
+        {
+            const auto eq = pair.find( '=' );
+            if( eq == std::string::npos )
+                return false;
+
+            const std::string key = pair.substr( 0, eq );
+            const std::string value = pair.substr( eq + 1 );
+            try
+            {
+                if( key == "count" )
+                {
+                    if( value.empty() || value.find_first_not_of( "0123456789" ) != std::string::npos )
+                        return false;
+                    settings.count = static_cast<size_t>( std::stoull( value ) );
+                }
+                else if( key == "prototypes" )
+                    settings.prototypes = std::stoi( value );
+                else if( key == "seed" )
+                    settings.seed = std::stoull( value );
+                else if( key == "leaf" )
+                    settings.leaf_size = std::stoi( value );
+                else
+                    return false;
+            }
+            catch( const std::exception & )
+            {
+                return false;
+            }
+        }
+
+        return settings.count > 0 && settings.prototypes > 0 && settings.leaf_size > 0;
+    }
+
+    // Trunk of stacked spheres under a crown of leaf spheres in an upright ellipsoid, standing on the origin. Every
+    // tree asks for its own materials, the pool hands out shared ones.
+    std::shared_ptr<sphere_set_t> make_tree( uint64_t seed, uint64_t tree, material_pool_t &materials )
+    {
+        const auto random = [seed, tree]( uint64_t index, uint64_t stream )
+        { return hashed_random( seed ^ 0x7265657274ull, tree * 4096 + index, stream ); };
+
+        const color_t greens[]
+            = { { 0.10, 0.35, 0.08 }, { 0.15, 0.45, 0.10 }, { 0.20, 0.40, 0.05 }, { 0.35, 0.50, 0.12 } };
+        const color_t autumn[]
+            = { { 0.60, 0.30, 0.05 }, { 0.70, 0.45, 0.10 }, { 0.55, 0.15, 0.05 }, { 0.65, 0.55, 0.15 } };
+        const color_t *leaves = tree % 4 == 3 ? autumn : greens;
+
+        std::vector<std::shared_ptr<material_t>> palette;
+        palette.push_back( materials.make<lambertian_t>( color_t{ 0.30, 0.20, 0.10 } ) );
+        for( int i = 0; i < 4; i++ )
+            palette.push_back( materials.make<lambertian_t>( leaves[i] ) );
+
+        const double trunk_height = 1.2 + 1.0 * random( 0, 0 );
+        const double crown_radius = 0.7 + 0.6 * random( 0, 1 );
+        const double crown_stretch = 1.0 + 0.6 * random( 0, 2 );
+        const int trunk_spheres = static_cast<int>( trunk_height / 0.1 );
+        const int leaf_spheres = 60 + static_cast<int>( 100 * random( 0, 3 ) );
+        const double max_radius = 0.35;
+        const point3_t crown_center{ 0.0, trunk_height + 0.6 * crown_radius * crown_stretch, 0.0 };
+
+        const double top = crown_center.y + crown_radius * crown_stretch;
+        const aabb_t center_bounds{ point3_t{ -crown_radius, 0.0, -crown_radius },
+                                    point3_t{ crown_radius, top, crown_radius } };
+        auto tree_set = std::make_shared<sphere_set_t>(
+            trunk_spheres + leaf_spheres, sphere_storage_t::full, center_bounds, max_radius, palette );
+
+        for( int i = 0; i < trunk_spheres; i++ )
+        {
+            const double taper = 1.0 - 0.4 * i / trunk_spheres;
+            tree_set->set( i, point3_t{ 0.0, 0.1 * ( i + 1 ), 0.0 }, 0.12 * taper, 0 );
+        }
+
+        for( int i = 0; i < leaf_spheres; i++ )
+        {
+            // Rejection sampling of the unit ball, counter based so it needs no generator state
+            vec3_t offset;
+            for( uint64_t attempt = 0;; attempt++ )
+            {
+                offset = vec3_t{ 2.0 * random( 1 + i, 3 * attempt ) - 1.0,
+                                 2.0 * random( 1 + i, 3 * attempt + 1 ) - 1.0,
+                                 2.0 * random( 1 + i, 3 * attempt + 2 ) - 1.0 };
+                if( length_squared( offset ) <= 1.0 )
+                    break;
+            }
+
+            const point3_t center{ crown_center.x + crown_radius * offset.x,
+                                   crown_center.y + crown_radius * crown_stretch * offset.y,
+                                   crown_center.z + crown_radius * offset.z };
+            const double radius = 0.18 + 0.14 * random( 1 + i, 1000 );
+            tree_set->set( trunk_spheres + i, center, radius, static_cast<uint16_t>( 1 + random( 1 + i, 1001 ) * 4 ) );
+        }
+
+        tree_set->build( 4 );
+        return tree_set;
+    }
+} // namespace
+
+void cornell_scene( scene_t &scene )
+{
+    auto &world = scene.world;
+
+    auto &materials = scene.materials;
+    const auto red = materials.make<lambertian_t>( color_t{ 0.65, 0.05, 0.05 } );
+    const auto white = materials.make<lambertian_t>( color_t{ 0.73, 0.73, 0.73 } );
+    const auto green = materials.make<lambertian_t>( color_t{ 0.12, 0.45, 0.15 } );
+
+    world.add(
+        std::make_shared<parallelogram_t>( point3_t{ 555, 0, 0 }, vec3_t{ 0, 555, 0 }, vec3_t{ 0, 0, 555 }, green ) );
+    world.add(
+        std::make_shared<parallelogram_t>( point3_t{ 0, 0, 0 }, vec3_t{ 0, 555, 0 }, vec3_t{ 0, 0, 555 }, red ) );
+    world.add(
+        std::make_shared<parallelogram_t>( point3_t{ 0, 0, 0 }, vec3_t{ 555, 0, 0 }, vec3_t{ 0, 0, 555 }, white ) );
+    world.add( std::make_shared<parallelogram_t>( point3_t{ 555, 555, 555 },
+                                                  vec3_t{ -555, 0, 0 },
+                                                  vec3_t{ 0, 0, -555 },
+                                                  white ) );
+    world.add(
+        std::make_shared<parallelogram_t>( point3_t{ 0, 0, 555 }, vec3_t{ 555, 0, 0 }, vec3_t{ 0, 555, 0 }, white ) );
+
+    // Ceiling panel facing down and a small warm sphere light
+    const color_t panel_emission{ 15.0, 15.0, 15.0 };
+    const auto panel = std::make_shared<parallelogram_t>( point3_t{ 343, 554, 332 },
+                                                          vec3_t{ -130, 0, 0 },
+                                                          vec3_t{ 0, 0, -105 },
+                                                          materials.make<diffuse_light_t>( panel_emission ) );
+    world.add( panel );
+    scene.lights.add( panel, dot( panel_emission, color_t{ 0.2126, 0.7152, 0.0722 } ) * panel->area() );
+
+    const color_t bulb_emission{ 40.0, 30.0, 20.0 };
+    const double bulb_radius = 15.0;
+    const auto bulb = std::make_shared<sphere_t>(
+        point3_t{ 120, 420, 200 }, bulb_radius, materials.make<diffuse_light_t>( bulb_emission ) );
+    world.add( bulb );
+    scene.lights.add( bulb,
+                      dot( bulb_emission, color_t{ 0.2126, 0.7152, 0.0722 } ) * 4.0 * pi * bulb_radius * bulb_radius );
+
+    world.add( std::make_shared<sphere_t>( point3_t{ 190, 90, 190 }, 90, materials.make<dielectric_t>( 1.5 ) ) );
+    world.add( std::make_shared<sphere_t>(
+        point3_t{ 400, 100, 380 }, 100, materials.make<metal_t>( color_t{ 0.8, 0.85, 0.88 }, 0.0 ) ) );
+    world.add( std::make_shared<sphere_t>( point3_t{ 390, 60, 120 }, 60, white ) );
+
+    scene.camera.lookfrom = point3_t{ 278, 278, -800 };
+    scene.camera.lookat = point3_t{ 278, 278, 0 };
+    scene.camera.vfov = 40.0;
+    scene.camera.aperture = 0.0;
+    scene.camera.focus_dist = 10.0;
+}
+
+bool procedural_scene( const procedural_settings_t &settings, scene_t &scene )
+{
+    constexpr size_t palette_size = 4096;
+    constexpr uint64_t max_count = 0xffffffffull;
+
+    size_t count = std::min<size_t>( settings.count, max_count );
+
+    // Pick the most precise storage and smallest leaves that fit the budget
+    struct layout_t
+    {
+        sphere_storage_t storage;
+        int leaf_size;
+    };
+    const layout_t layouts[] = { { sphere_storage_t::full, settings.leaf_size },
+                                 { sphere_storage_t::quantized, settings.leaf_size },
+                                 { sphere_storage_t::quantized, std::max( settings.leaf_size, 8 ) },
+                                 { sphere_storage_t::quantized, std::max( settings.leaf_size, 16 ) } };
+
+    layout_t layout = layouts[0];
+    std::string budget_note;
+    if( settings.budget_mb > 0.0 )
+    {
+        const double budget = settings.budget_mb * 1024.0 * 1024.0;
+
+        bool fits = false;
+        for( const auto &candidate : layouts )
+        {
+            layout = candidate;
+            if( sphere_set_t::estimate_peak_memory_bytes( count, layout.storage, layout.leaf_size ) <= budget )
+            {
+                fits = true;
+                break;
+            }
+        }
+
+        if( !fits )
+        {
+            const double per_sphere
+                = double( sphere_set_t::estimate_peak_memory_bytes( count, layout.storage, layout.leaf_size ) ) / count;
+            count = static_cast<size_t>( budget / per_sphere );
+            if( count == 0 )
+            {
+                std::cerr << "A budget of " << settings.budget_mb << " MB does not fit a single sphere\n";
+                return false;
+            }
+            budget_note = ", reduced from " + std::to_string( settings.count ) + " spheres to fit the budget";
+        }
+    }
+
+    const size_t side = static_cast<size_t>( std::ceil( std::sqrt( double( std::max<size_t>( count, 1 ) ) ) ) );
+    const double extent = settings.extent > 0.0 ? settings.extent : 0.5 * side;
+    const double cell = 2.0 * extent / side;
+    const double max_radius = 0.2 * cell;
+    const uint64_t seed = settings.seed;
+
+    // Same mix as random_scene: 80% diffuse, 15% metal, 5% glass
+    std::vector<std::shared_ptr<material_t>> palette( palette_size );
+    for( size_t i = 0; i < palette_size; i++ )
+    {
+        const auto random = [seed, i]( uint64_t stream ) { return hashed_random( seed, i, stream ); };
+
+        const auto choose_mat = random( 0 );
+        if( choose_mat < 0.8 )
+        {
+            const color_t albedo{ random( 1 ), random( 2 ), random( 3 ) };
+            palette[i] = scene.materials.make<lambertian_t>( albedo );
+        }
+        else if( choose_mat < 0.95 )
+        {
+            const color_t albedo{ 0.5 + 0.5 * random( 1 ), 0.5 + 0.5 * random( 2 ), 0.5 + 0.5 * random( 3 ) };
+            palette[i] = scene.materials.make<metal_t>( albedo, 0.5 * random( 4 ) );
+        }
+        else
+        {
+            palette[i] = scene.materials.make<dielectric_t>( 1.5 );
+        }
+    }
+
+    const aabb_t center_bounds{ point3_t{ -extent, 0.0, -extent }, point3_t{ extent, max_radius, extent } };
+    auto spheres = std::make_shared<sphere_set_t>( count, layout.storage, center_bounds, max_radius, palette );
+
+    {
+        TRACE_SCOPE( "generate_spheres" );
+
+        const int64_t n = static_cast<int64_t>( count );
+
+#pragma omp parallel for schedule( static )
+        for( int64_t i = 0; i < n; i++ )
+        {
+            const auto random
+                = [seed, i]( uint64_t stream ) { return hashed_random( seed, palette_size + i, stream ); };
+
+            const size_t a = size_t( i ) % side;
+            const size_t b = size_t( i ) / side;
+            const double radius = max_radius * ( 0.5 + 0.5 * random( 0 ) );
+            const point3_t center{ -extent + ( a + 0.05 + 0.9 * random( 1 ) ) * cell,
+                                   radius,
+                                   -extent + ( b + 0.05 + 0.9 * random( 2 ) ) * cell };
+
+            spheres->set( size_t( i ), center, radius, static_cast<uint16_t>( random( 3 ) * palette_size ) );
+        }
+    }
+
+    const auto index_start = std::chrono::steady_clock::now();
+    spheres->build( layout.leaf_size );
+    scene.index_ms += milliseconds_since( index_start );
+
+    const double ground_radius = std::max( 1000.0, 100.0 * extent );
+    const auto ground_material = scene.materials.make<lambertian_t>( color_t{ 0.5, 0.5, 0.5 } );
+    scene.world.add(
+        std::make_shared<sphere_t>( point3_t{ 0.0, -ground_radius, 0.0 }, ground_radius, ground_material ) );
+    scene.world.add( spheres );
+
+    const auto material1 = scene.materials.make<dielectric_t>( 1.5 );
+    scene.world.add( std::make_shared<sphere_t>( point3_t{ 0, 1, 0 }, 1.0, material1 ) );
+
+    const auto material2 = scene.materials.make<lambertian_t>( color_t{ 0.4, 0.2, 0.1 } );
+    scene.world.add( std::make_shared<sphere_t>( point3_t{ -4, 1, 0 }, 1.0, material2 ) );
+
+    const auto material3 = scene.materials.make<metal_t>( color_t{ 0.7, 0.6, 0.5 }, 0.0 );
+    scene.world.add( std::make_shared<sphere_t>( point3_t{ 4, 1, 0 }, 1.0, material3 ) );
+
+    scene.primitive_count = count + 4;
+    scene.memory_bytes = spheres->memory_bytes();
+    scene.description = std::string( sphere_set_t::storage_name( layout.storage ) ) + " storage, leaf size "
+                        + std::to_string( layout.leaf_size ) + budget_note;
+    return true;
+}
+
+void forest_scene( const forest_settings_t &settings, scene_t &scene )
+{
+    constexpr double cell = 3.0;
+    const uint64_t seed = settings.seed;
+
+    std::vector<std::shared_ptr<const hittable_t>> prototypes;
+    std::vector<size_t> prototype_spheres;
+    size_t prototype_bytes = 0;
+    for( int i = 0; i < settings.prototypes; i++ )
+    {
+        const auto tree = make_tree( seed, uint64_t( i ), scene.materials );
+        prototype_spheres.push_back( tree->size() );
+        prototype_bytes += tree->memory_bytes();
+        prototypes.push_back( tree );
+    }
+
+    const size_t count = settings.count;
+    const size_t side = static_cast<size_t>( std::ceil( std::sqrt( double( count ) ) ) );
+    const double extent = 0.5 * side * cell;
+    auto forest = std::make_shared<instance_set_t>( count, std::move( prototypes ) );
+
+    // One tree per grid cell, rotated about its trunk and scaled, slightly more in height than in width
+    std::vector<uint32_t> prototype_of( count );
+    {
+        TRACE_SCOPE( "place_instances" );
+
+        const int64_t n = static_cast<int64_t>( count );
+
+#pragma omp parallel for schedule( static )
+        for( int64_t i = 0; i < n; i++ )
+        {
+            const auto random = [seed, i]( uint64_t stream ) { return hashed_random( seed, uint64_t( i ), stream ); };
+
+            const size_t a = size_t( i ) % side;
+            const size_t b = size_t( i ) / side;
+            const point3_t position{ -extent + ( a + 0.2 + 0.6 * random( 0 ) ) * cell,
+                                     0.0,
+                                     -extent + ( b + 0.2 + 0.6 * random( 1 ) ) * cell };
+            const double size = 0.7 + 0.6 * random( 2 );
+            const double stretch = 0.85 + 0.3 * random( 3 );
+            prototype_of[i] = static_cast<uint32_t>( random( 4 ) * settings.prototypes );
+
+            forest->set( size_t( i ),
+                         prototype_of[i],
+                         transform_t::translate( position ) * transform_t::rotate_y( 360.0 * random( 5 ) )
+                             * transform_t::scale( vec3_t{ size, size * stretch, size } ) );
+        }
+    }
+
+    std::vector<size_t> instances_of( settings.prototypes, 0 );
+    for( const uint32_t prototype : prototype_of )
+        instances_of[prototype]++;
+    prototype_of = std::vector<uint32_t>();
+
+    const auto index_start = std::chrono::steady_clock::now();
+    forest->build( settings.leaf_size );
+    scene.index_ms += milliseconds_since( index_start );
+
+    const double ground_radius = std::max( 1000.0, 100.0 * extent );
+    const auto ground_material = scene.materials.make<lambertian_t>( color_t{ 0.35, 0.40, 0.20 } );
+    scene.world.add(
+        std::make_shared<sphere_t>( point3_t{ 0.0, -ground_radius, 0.0 }, ground_radius, ground_material ) );
+    scene.world.add( forest );
+
+    // From just outside one edge, looking in
+    scene.camera.lookfrom = point3_t{ 0.0, 5.0, extent + 6.0 };
+    scene.camera.lookat = point3_t{ 0.0, 1.0, std::max( 0.0, extent - 30.0 ) };
+    scene.camera.vfov = 40.0;
+    scene.camera.aperture = 0.0;
+    scene.camera.focus_dist = length( scene.camera.lookfrom - scene.camera.lookat );
+
+    size_t stored_spheres = 0;
+    size_t instanced_spheres = 0;
+    for( int i = 0; i < settings.prototypes; i++ )
+    {
+        stored_spheres += prototype_spheres[i];
+        instanced_spheres += prototype_spheres[i] * instances_of[i];
+    }
+
+    scene.primitive_count = instanced_spheres + 1;
+    scene.memory_bytes = forest->memory_bytes() + prototype_bytes;
+    scene.description = std::to_string( count ) + " instances of " + std::to_string( settings.prototypes )
+                        + " prototypes with " + std::to_string( stored_spheres ) + " spheres, "
+                        + std::to_string( prototype_bytes / 1024 ) + " KB of prototypes";
+}
+
+bool textured_scene( const textured_settings_t &settings, scene_t &scene )
+{
+    scene.textures = std::make_shared<texture_cache_t>( static_cast<size_t>( settings.cache_mb * 1024.0 * 1024.0 ),
+                                                        settings.tile_size );
+
+    std::vector<std::shared_ptr<texture_t>> textures;
+    for( const auto &path : settings.textures )
+    {
+        const int id = scene.textures->open( path );
+        if( id < 0 )
+        {
+            std::cerr << "Cannot read texture " << path << " (expected a binary PPM with 8 bit channels)\n";
+            return false;
+        }
+        textures.push_back( std::make_shared<image_texture_t>( scene.textures, id ) );
+    }
+
+    const auto ground_material = scene.materials.make<lambertian_t>( color_t{ 0.5, 0.5, 0.5 } );
+    scene.world.add( std::make_shared<sphere_t>( point3_t{ 0.0, -1000.0, 0.0 }, 1000, ground_material ) );
+
+    // Unit spheres on a square grid, every fourth one a slightly fuzzy metal
+    constexpr double spacing = 2.5;
+    const int columns = static_cast<int>( std::ceil( std::sqrt( double( settings.count ) ) ) );
+    const double offset = ( columns - 1 ) * spacing / 2.0;
+    for( size_t i = 0; i < settings.count; i++ )
+    {
+        const auto &texture = textures[i % textures.size()];
+        std::shared_ptr<material_t> material;
+        if( i % 4 == 3 )
+            material = scene.materials.make<metal_t>( texture, 0.2, color_t{ 0.9, 0.9, 0.9 } );
+        else
+            material = scene.materials.make<lambertian_t>( texture );
+
+        const point3_t center{
+            double( i % columns ) * spacing - offset, 1.0, double( i / columns ) * spacing - offset };
+        scene.world.add( std::make_shared<sphere_t>( center, 1.0, material ) );
+    }
+
+    const double extent = offset + 1.0;
+    scene.camera.lookfrom = point3_t{ 0.0, 2.0 + extent, 8.0 + 2.5 * extent };
+    scene.camera.lookat = point3_t{ 0.0, 0.8, 0.0 };
+    scene.camera.vfov = 30.0;
+    scene.camera.aperture = 0.0;
+    scene.camera.focus_dist = length( scene.camera.lookfrom - scene.camera.lookat );
+
+    scene.description = std::to_string( settings.textures.size() ) + " textures, cache of "
+                        + std::to_string( static_cast<int>( settings.cache_mb ) ) + " MB in "
+                        + std::to_string( settings.tile_size ) + " texel tiles";
+    return true;
+}
+
+std::shared_ptr<scene_t> make_scene( const std::string &name, int leaf_size )
+{
+    TRACE_SCOPE( "build_scene" );
+    PERF_PHASE( "build_scene" );
+
+    const auto start = std::chrono::steady_clock::now();
+
+    auto scene = std::make_shared<scene_t>();
+    scene->rng.random_double();
+
+    const std::string procedural_prefix = "procedural";
+    const std::string forest_prefix = "forest";
+    const std::string textured_prefix = "textured:";
+
+    if( name == "simple" )
+    {
+        scene->world = simple_scene( scene->materials );
+    }
+    else if( name == "random" )
+    {
+        scene->world = random_scene( scene->rng, scene->materials );
+    }
+    else if( name == "cornell" )
+    {
+        cornell_scene( *scene );
+    }
+    else if( name.compare( 0, procedural_prefix.size(), procedural_prefix ) == 0 )
+    {
+        procedural_settings_t settings;
+        if( leaf_size > 0 )
+            settings.leaf_size = leaf_size;
+        if( name.size() > procedural_prefix.size()
+            && ( name[procedural_prefix.size()] != ':'
+                 || !parse_procedural_settings( name.substr( procedural_prefix.size() + 1 ), settings ) ) )
+            return nullptr;
+
+        if( !procedural_scene( settings, *scene ) )
+            return nullptr;
+    }
+    else if( name.compare( 0, forest_prefix.size(), forest_prefix ) == 0 )
+    {
+        forest_settings_t settings;
+        if( leaf_size > 0 )
+            settings.leaf_size = leaf_size;
+        if( name.size() > forest_prefix.size()
+            && ( name[forest_prefix.size()] != ':'
+                 || !parse_forest_settings( name.substr( forest_prefix.size() + 1 ), settings ) ) )
+            return nullptr;
+
+        forest_scene( settings, *scene );
+    }
+    else if( name.compare( 0, textured_prefix.size(), textured_prefix ) == 0 )
+    {
+        textured_settings_t settings;
+        if( !parse_textured_settings( name.substr( textured_prefix.size() ), settings )
+            || !textured_scene( settings, *scene ) )
+            return nullptr;
+    }
+    else
+    {
+        return nullptr;
+    }
+
+    {
+        TRACE_SCOPE( "build_bvh" );
+        const auto index_start = std::chrono::steady_clock::now();
+        if( leaf_size > 0 )
+            scene->world.build_bvh( leaf_size );
+        else
+            scene->world.build_bvh();
+        scene->index_ms += milliseconds_since( index_start );
+    }
+
+    if( scene->primitive_count == 0 )
+        scene->primitive_count = scene->world.size();
+    scene->build_ms = milliseconds_since( start );
+
+    return scene;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "camera.hpp"
+#include "hittable_list.hpp"
+#include "light_list.hpp"
+#include "material_pool.hpp"
+#include "texture_cache.hpp"
+#include "utils.hpp"
+
+class scene_t
+{
+public:
+    hittable_list_t world;
+    light_list_t lights; // scenes without lights are lit by the sky
+    camera_settings_t camera;
+    std::shared_ptr<texture_cache_t> textures; // nullptr for scenes without image textures
+    material_pool_t materials;                 // deduplicates the materials of scenes built through it
+
+    // State of the generator after the scene was built, jobs are seeded from it
+    random_number_generator_t rng;
+
+    // Construction statistics
+    size_t primitive_count{ 0 };
+    size_t memory_bytes{ 0 }; // geometry and index of procedural scenes, 0 when not tracked
+    double build_ms{ 0.0 };   // including the index
+    double index_ms{ 0.0 };
+    std::string description;
+};
+
+// Parameters of the procedural scene, written as procedural:count=N,extent=E,seed=S,budget_mb=M,leaf=L
+class procedural_settings_t
+{
+public:
+    size_t count{ 1000000 };
+    double extent{ 0.0 }; // half width of the square the spheres cover, 0 keeps random_scene's density
+    uint64_t seed{ 1 };
+    double budget_mb{ 0.0 }; // 0 for no limit
+    int leaf_size{ 4 };
+};
+
+// Parameters of the textured scene, written as textured:texture=FILE,texture=FILE,count=N,cache_mb=M,tile=T
+class textured_settings_t
+{
+public:
+    std::vector<std::string> textures; // binary PPM files, at least one
+    size_t count{ 16 };                // spheres, the textures are used in turn
+    double cache_mb{ 256.0 };          // decoded tiles kept in memory
+    int tile_size{ 64 };
+};
+
+// Parameters of the instanced forest scene, written as forest:count=N,prototypes=P,seed=S,leaf=L
+class forest_settings_t
+{
+public:
+    size_t count{ 100000 }; // trees
+    int prototypes{ 8 };    // distinct tree shapes, each instance is a scaled and rotated copy of one
+    uint64_t seed{ 1 };
+    int leaf_size{ 2 }; // of the hierarchy over the instances
+};
+
+[[nodiscard]] hittable_list_t simple_scene( material_pool_t &materials );
+[[nodiscard]] hittable_list_t random_scene( random_number_generator_t &rng, material_pool_t &materials );
+
+// Closed room lit by a ceiling panel and a small sphere light
+void cornell_scene( scene_t &scene );
+
+// The material mix of random_scene at any density, generated and indexed in parallel. False if the memory budget
+// does not fit a single sphere.
+bool procedural_scene( const procedural_settings_t &settings, scene_t &scene );
+
+// Trees made of sphere clusters, instanced from a few prototypes with their materials deduplicated
+void forest_scene( const forest_settings_t &settings, scene_t &scene );
+
+// Grid of spheres with image textures on a plain ground, false if a texture cannot be read
+bool textured_scene( const textured_settings_t &settings, scene_t &scene );
+
+// Returns nullptr if there is no scene with the given name. leaf_size sets the leaf size of the scene's indices
+// where the name does not, 0 keeps the defaults.
+[[nodiscard]] std::shared_ptr<scene_t> make_scene( const std::string &name, int leaf_size = 0 );
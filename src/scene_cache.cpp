@@ -0,0 +1,96 @@
+#include "scene_cache.hpp"
+
+std::shared_ptr<const scene_t> scene_cache_t::get( const std::string &name, bool &was_cached )
+{
+    std::promise<std::shared_ptr<const scene_t>> promise;
+    scene_future_t scene;
+    bool owner = false;
+    size_t entry_id = 0;
+
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+
+        const auto it = index.find( name );
+        if( it != index.end() )
+        {
+            entries.splice( entries.begin(), entries, it->second );
+            scene = it->second->scene;
+            hits_++;
+        }
+        else
+        {
+            scene = promise.get_future().share();
+            entry_id = next_entry_id++;
+            entries.push_front( entry_t{ name, scene, entry_id } );
+            index[name] = entries.begin();
+            misses_++;
+            owner = true;
+            evict_locked();
+        }
+    }
+
+    was_cached = !owner;
+
+    if( owner )
+    {
+        // Build outside the lock so requests for other scenes are not blocked. A failed build is handed to everyone
+        // waiting for it and, like an unknown name, not cached.
+        std::shared_ptr<const scene_t> built;
+        try
+        {
+            built = make_scene( name );
+            promise.set_value( built );
+        }
+        catch( ... )
+        {
+            promise.set_exception( std::current_exception() );
+        }
+
+        if( !built )
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            const auto it = index.find( name );
+            if( it != index.end() && it->second->id == entry_id )
+            {
+                entries.erase( it->second );
+                index.erase( it );
+            }
+        }
+    }
+
+    return scene.get();
+}
+
+void scene_cache_t::evict_locked()
+{
+    while( entries.size() > capacity_ )
+    {
+        index.erase( entries.back().name );
+        entries.pop_back();
+        evictions_++;
+    }
+}
+
+size_t scene_cache_t::hits() const
+{
+    std::lock_guard<std::mutex> lock( mutex );
+    return hits_;
+}
+
+size_t scene_cache_t::misses() const
+{
+    std::lock_guard<std::mutex> lock( mutex );
+    return misses_;
+}
+
+size_t scene_cache_t::evictions() const
+{
+    std::lock_guard<std::mutex> lock( mutex );
+    return evictions_;
+}
+
+size_t scene_cache_t::size() const
+{
+    std::lock_guard<std::mutex> lock( mutex );
+    return entries.size();
+}
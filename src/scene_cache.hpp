@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "scene.hpp"
+
+// Keeps the most recently used scenes in memory so repeated requests skip scene construction.
+// Scenes are handed out as shared pointers, an evicted scene stays alive until the last render using it is done.
+class scene_cache_t
+{
+public:
+    explicit scene_cache_t( size_t capacity ) : capacity_( capacity > 0 ? capacity : 1 ) { }
+
+    // Returns nullptr for unknown scene names. was_cached is set when no construction was needed.
+    // Concurrent requests for a scene that is being built wait for that build instead of starting another. If the
+    // build throws, every one of them gets the exception.
+    std::shared_ptr<const scene_t> get( const std::string &name, bool &was_cached );
+
+    size_t hits() const;
+    size_t misses() const;
+    size_t evictions() const;
+    size_t size() const;
+
+private:
+    using scene_future_t = std::shared_future<std::shared_ptr<const scene_t>>;
+
+    struct entry_t
+    {
+        std::string name;
+        scene_future_t scene;
+        size_t id;
+    };
+
+    void evict_locked();
+
+private:
+    size_t capacity_;
+    mutable std::mutex mutex;
+    std::list<entry_t> entries; // most recently used first
+    std::unordered_map<std::string, std::list<entry_t>::iterator> index;
+    size_t hits_{ 0 };
+    size_t misses_{ 0 };
+    size_t evictions_{ 0 };
+    size_t next_entry_id{ 0 };
+};
@@ -0,0 +1,585 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.hpp"
+#include "renderer.hpp"
+#include "scene_cache.hpp"
+#include "perf_counters.hpp"
+#include "trace.hpp"
+
+namespace
+{
+    // Deadline requests rendering at the same time, later ones wait for one of them to finish
+    constexpr unsigned max_budgeted_renders = 8;
+
+    using request_args_t = std::map<std::string, std::string>;
+
+    // Everything a single render request needs while its rows are spread over the pool
+    struct render_request_t
+    {
+        std::string id;
+        std::string out_path;
+        render_settings_t settings;
+        std::shared_ptr<const scene_t> scene;
+        bool scene_cached{ false };
+        std::unique_ptr<camera_t> cam;
+        std::vector<Job> jobs;
+        image_t pixel;
+        std::chrono::steady_clock::time_point start;
+        double deadline_ms{ 0.0 }; // fixed sample count when zero
+        std::unique_ptr<accumulation_buffer_t> accumulation;
+    };
+
+    // One client connection, or stdin/stdout
+    class session_t
+    {
+    public:
+        session_t( int in_fd, int out_fd ) : in_fd( in_fd ), out_fd( out_fd ) { }
+
+        bool read_line( std::string &line )
+        {
+            while( !closed )
+            {
+                const auto newline = buffer.find( '\n' );
+                if( newline != std::string::npos )
+                {
+                    line = buffer.substr( 0, newline );
+                    buffer.erase( 0, newline + 1 );
+                    return true;
+                }
+
+                char chunk[4096];
+                const ssize_t n = ::read( in_fd, chunk, sizeof( chunk ) );
+                if( n <= 0 )
+                {
+                    if( buffer.empty() )
+                        return false;
+                    line.swap( buffer );
+                    buffer.clear();
+                    return true;
+                }
+                buffer.append( chunk, n );
+            }
+            return false;
+        }
+
+        // A client that went away ends the session, its pending requests still finish
+        void write_line( const std::string &line )
+        {
+            std::lock_guard<std::mutex> lock( write_mutex );
+
+            const std::string data = line + '\n';
+            size_t written = 0;
+            while( !closed && written < data.size() )
+            {
+                const ssize_t n = ::write( out_fd, data.data() + written, data.size() - written );
+                if( n <= 0 )
+                {
+                    closed = true;
+                    ::shutdown( in_fd, SHUT_RD ); // wakes up read_line() on sockets
+                    return;
+                }
+                written += n;
+            }
+        }
+
+        void begin_request()
+        {
+            std::lock_guard<std::mutex> lock( pending_mutex );
+            pending++;
+        }
+
+        void end_request()
+        {
+            std::lock_guard<std::mutex> lock( pending_mutex );
+            if( --pending == 0 )
+                pending_done.notify_all();
+        }
+
+        void wait_for_requests()
+        {
+            std::unique_lock<std::mutex> lock( pending_mutex );
+            pending_done.wait( lock, [this] { return pending == 0; } );
+        }
+
+    private:
+        int in_fd;
+        int out_fd;
+        std::string buffer;
+        std::mutex write_mutex;
+        std::mutex pending_mutex;
+        std::condition_variable pending_done;
+        int pending{ 0 };
+        std::atomic<bool> closed{ false };
+    };
+
+    class server_t
+    {
+    public:
+        explicit server_t( const server_settings_t &settings )
+            : pool( settings.thread_count, settings.pin_policy ),
+              budget_coordinators( max_budgeted_renders, pin_policy_t::none, "budget" ),
+              cache( settings.cache_capacity )
+        {
+        }
+
+        // Returns false when the client asked to shut the server down
+        bool run_session( session_t &session );
+
+        void request_shutdown()
+        {
+            shutdown_requested = true;
+        }
+
+        bool is_shutting_down() const
+        {
+            return shutdown_requested;
+        }
+
+    private:
+        void handle_render( session_t &session, const request_args_t &args );
+        void start_render( session_t &session, std::shared_ptr<render_request_t> request, const request_args_t &args );
+        void render_budgeted( session_t &session, std::shared_ptr<render_request_t> request );
+        void finish_render( session_t &session, render_request_t &request, const std::string &details );
+        std::string stats() const;
+
+    private:
+        thread_pool_t pool;
+        thread_pool_t budget_coordinators; // run the pass loops of deadline requests, declared after pool to go first
+        scene_cache_t cache;
+        std::atomic<size_t> request_count{ 0 };
+        std::atomic<bool> shutdown_requested{ false };
+    };
+
+    bool parse_vec3( const std::string &text, vec3_t &v )
+    {
+        char comma1 = 0;
+        char comma2 = 0;
+        std::istringstream in( text );
+        in >> v.x >> comma1 >> v.y >> comma2 >> v.z;
+        return !in.fail() && comma1 == ',' && comma2 == ',';
+    }
+
+    bool parse_int( const request_args_t &args, const char *key, int &value, std::string &error, int min_value = 1 )
+    {
+        const auto it = args.find( key );
+        if( it == args.end() )
+            return true;
+
+        try
+        {
+            size_t used = 0;
+            value = std::stoi( it->second, &used );
+            if( used == it->second.size() && value >= min_value )
+                return true;
+        }
+        catch( const std::exception & )
+        {
+        }
+
+        error = std::string( "invalid " ) + key;
+        if( min_value > 1 )
+            error += ", needs at least " + std::to_string( min_value );
+        return false;
+    }
+
+    bool parse_double( const request_args_t &args, const char *key, double &value, std::string &error )
+    {
+        const auto it = args.find( key );
+        if( it == args.end() )
+            return true;
+
+        try
+        {
+            size_t used = 0;
+            value = std::stod( it->second, &used );
+            if( used == it->second.size() )
+                return true;
+        }
+        catch( const std::exception & )
+        {
+        }
+
+        error = std::string( "invalid " ) + key;
+        return false;
+    }
+
+    bool parse_point( const request_args_t &args, const char *key, vec3_t &value, std::string &error )
+    {
+        const auto it = args.find( key );
+        if( it == args.end() || parse_vec3( it->second, value ) )
+            return true;
+
+        error = std::string( "invalid " ) + key;
+        return false;
+    }
+
+    bool server_t::run_session( session_t &session )
+    {
+        std::string line;
+        while( !shutdown_requested && session.read_line( line ) )
+        {
+            std::istringstream in( line );
+            std::string command;
+            in >> command;
+
+            request_args_t args;
+            std::string token;
+            while( in >> token )
+            {
+                const auto eq = token.find( '=' );
+                if( eq == std::string::npos )
+                    args[token] = "";
+                else
+                    args[token.substr( 0, eq )] = token.substr( eq + 1 );
+            }
+
+            if( command.empty() )
+                continue;
+            else if( command == "render" )
+                handle_render( session, args );
+            else if( command == "stats" )
+                session.write_line( stats() );
+            else if( command == "quit" )
+                break;
+            else if( command == "shutdown" )
+                request_shutdown();
+            else
+                session.write_line( "error unknown command " + command );
+        }
+
+        session.wait_for_requests();
+        return !shutdown_requested;
+    }
+
+    void server_t::handle_render( session_t &session, const request_args_t &args )
+    {
+        auto request = std::make_shared<render_request_t>();
+        request->start = std::chrono::steady_clock::now();
+
+        const auto id = args.find( "id" );
+        request->id = id != args.end() ? id->second : std::to_string( request_count.load() );
+
+        const auto out = args.find( "out" );
+        const auto scene = args.find( "scene" );
+        if( out == args.end() || out->second.empty() || scene == args.end() )
+        {
+            session.write_line( "error id=" + request->id + " render needs scene= and out=" );
+            return;
+        }
+        request->out_path = out->second;
+
+        // The camera spans the first to the last pixel, so an image needs two of them per side
+        std::string error;
+        auto &settings = request->settings;
+        if( !parse_int( args, "width", settings.image_width, error, 2 )
+            || !parse_int( args, "height", settings.image_height, error, 2 )
+            || !parse_int( args, "spp_x", settings.samples_per_pixel_x, error )
+            || !parse_int( args, "spp_y", settings.samples_per_pixel_y, error )
+            || !parse_int( args, "depth", settings.max_depth, error )
+            || !parse_int( args, "tile_rows", settings.tile_rows, error )
+            || !parse_int( args, "packet_width", settings.packet_width, error )
+            || !parse_double( args, "deadline_ms", request->deadline_ms, error ) )
+        {
+            session.write_line( "error id=" + request->id + ' ' + error );
+            return;
+        }
+
+        request_count++;
+        session.begin_request();
+
+        // Scene lookup may have to build the scene, do it on the pool so this session keeps reading requests
+        pool.submit( { [this, &session, request, args]
+                       {
+                           try
+                           {
+                               start_render( session, request, args );
+                           }
+                           catch( const std::exception &e )
+                           {
+                               session.write_line( "error id=" + request->id + ' ' + e.what() );
+                               session.end_request();
+                           }
+                       } } );
+    }
+
+    void server_t::start_render( session_t &session,
+                                 std::shared_ptr<render_request_t> request,
+                                 const request_args_t &args )
+    {
+        TRACE_SCOPE( "start_render" );
+
+        request->scene = cache.get( args.at( "scene" ), request->scene_cached );
+        if( !request->scene )
+        {
+            session.write_line( "error id=" + request->id + " unknown scene " + args.at( "scene" ) );
+            session.end_request();
+            return;
+        }
+
+        std::string error;
+        camera_settings_t camera = request->scene->camera;
+        if( !parse_point( args, "lookfrom", camera.lookfrom, error )
+            || !parse_point( args, "lookat", camera.lookat, error )
+            || !parse_double( args, "vfov", camera.vfov, error )
+            || !parse_double( args, "aperture", camera.aperture, error )
+            || !parse_double( args, "focus", camera.focus_dist, error ) )
+        {
+            session.write_line( "error id=" + request->id + ' ' + error );
+            session.end_request();
+            return;
+        }
+
+        const auto &settings = request->settings;
+        const double aspect_ratio = double( settings.image_width ) / settings.image_height;
+        request->cam = std::make_unique<camera_t>( camera, aspect_ratio, settings.image_height );
+        request->jobs = create_jobs( settings, *request->scene, *request->cam );
+
+        if( request->deadline_ms > 0.0 )
+        {
+            // The budgeted renderer waits for each of its passes, so it cannot run on a pool worker
+            budget_coordinators.submit( { [this, &session, request] { render_budgeted( session, request ); } } );
+            return;
+        }
+
+        request->pixel = image_t( settings.image_height, std::vector<color_t>( settings.image_width, color_t{} ) );
+
+        const int rows = band_rows( settings );
+        std::vector<thread_pool_t::task_t> tasks;
+        tasks.reserve( ( settings.image_height + rows - 1 ) / rows );
+        for( int band = 0; band < settings.image_height; band += rows )
+        {
+            tasks.emplace_back(
+                [request, band, rows]
+                {
+                    TRACE_SCOPE_ARG( "render_band", band );
+                    PERF_TILE( "render_band", band );
+
+                    const auto &settings = request->settings;
+                    const int image_width = settings.image_width;
+                    const int band_end = std::min( band + rows, settings.image_height );
+                    render_rect( request->jobs, image_width, 0, band, image_width, band_end, settings.packet_width );
+
+                    for( int row = band; row < band_end; row++ )
+                    {
+                        for( int col = 0; col < image_width; col++ )
+                            request->pixel[row][col] = request->jobs[row * image_width + col].color;
+                    }
+                } );
+        }
+
+        pool.submit( std::move( tasks ), [this, &session, request] { finish_render( session, *request, "" ); } );
+    }
+
+    void server_t::render_budgeted( session_t &session, std::shared_ptr<render_request_t> request )
+    {
+        const auto &settings = request->settings;
+        const auto deadline = request->start
+                              + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  std::chrono::duration<double, std::milli>( request->deadline_ms ) );
+
+        request->accumulation = std::make_unique<accumulation_buffer_t>( settings.image_width, settings.image_height );
+        const budget_report_t report
+            = render_within_budget( pool, settings, request->jobs, *request->accumulation, deadline );
+
+        std::ostringstream details;
+        details << " spp=" << report.min_samples << '-' << report.max_samples << " depth=" << report.max_depth
+                << " passes=" << report.passes << " rel_error=" << report.relative_error;
+        if( report.overrun_ms > 0.0 )
+            details << " overrun_ms=" << report.overrun_ms;
+        finish_render( session, *request, details.str() );
+    }
+
+    void server_t::finish_render( session_t &session, render_request_t &request, const std::string &details )
+    {
+        std::ofstream out( request.out_path );
+        if( request.accumulation )
+            write_image( out, *request.accumulation );
+        else
+            write_image( out, request.settings, request.pixel );
+        out.close();
+
+        if( !out )
+        {
+            session.write_line( "error id=" + request.id + " cannot write " + request.out_path );
+        }
+        else
+        {
+            const auto elapsed = std::chrono::steady_clock::now() - request.start;
+            const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>( elapsed ).count();
+
+            // The texture cache belongs to the scene, so its counters cover every request of the scene so far
+            std::string texture_stats;
+            if( request.scene->textures )
+            {
+                const texture_cache_t::stats_t stats = request.scene->textures->stats();
+                texture_stats = " texture_hit_rate=" + std::to_string( stats.hit_rate() )
+                                + " texture_misses=" + std::to_string( stats.misses )
+                                + " texture_evictions=" + std::to_string( stats.evictions );
+            }
+
+            session.write_line( "done id=" + request.id + " out=" + request.out_path + " scene_cached="
+                                + ( request.scene_cached ? "1" : "0" ) + " ms=" + std::to_string( ms ) + details
+                                + texture_stats );
+        }
+
+        // Release the request's buffers before the session is allowed to finish
+        request.jobs.clear();
+        request.pixel.clear();
+        request.accumulation.reset();
+        session.end_request();
+    }
+
+    std::string server_t::stats() const
+    {
+        return "stats requests=" + std::to_string( request_count.load() ) + " cache_size="
+               + std::to_string( cache.size() ) + " cache_hits=" + std::to_string( cache.hits() )
+               + " cache_misses=" + std::to_string( cache.misses() )
+               + " cache_evictions=" + std::to_string( cache.evictions() );
+    }
+
+    int serve_socket( server_t &server, const std::string &path )
+    {
+        const int listen_fd = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+        if( listen_fd < 0 )
+        {
+            std::cerr << "Cannot create socket\n";
+            return EXIT_FAILURE;
+        }
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if( path.size() >= sizeof( address.sun_path ) )
+        {
+            std::cerr << "Socket path too long: " << path << '\n';
+            ::close( listen_fd );
+            return EXIT_FAILURE;
+        }
+        path.copy( address.sun_path, path.size() );
+
+        ::unlink( path.c_str() );
+        if( ::bind( listen_fd, reinterpret_cast<sockaddr *>( &address ), sizeof( address ) ) < 0
+            || ::listen( listen_fd, 16 ) < 0 )
+        {
+            std::cerr << "Cannot listen on " << path << '\n';
+            ::close( listen_fd );
+            return EXIT_FAILURE;
+        }
+
+        std::cerr << "Listening on " << path << '\n';
+
+        struct connection_t
+        {
+            std::thread thread;
+            std::atomic<bool> done{ false };
+        };
+
+        std::list<connection_t> connections;
+        std::mutex open_mutex;
+        std::set<int> open_fds; // connections that have not closed their socket yet
+        while( !server.is_shutting_down() )
+        {
+            const int fd = ::accept( listen_fd, nullptr, nullptr );
+            if( fd < 0 )
+                break;
+
+            // Join the sessions that have ended, so a long running server keeps no thread per client it served
+            for( auto it = connections.begin(); it != connections.end(); )
+            {
+                if( it->done )
+                {
+                    it->thread.join();
+                    it = connections.erase( it );
+                }
+                else
+                    ++it;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock( open_mutex );
+                open_fds.insert( fd );
+            }
+            connection_t &connection = connections.emplace_back();
+            connection.thread = std::thread(
+                [&server, &open_mutex, &open_fds, &done = connection.done, listen_fd, fd]
+                {
+                    session_t session( fd, fd );
+                    if( !server.run_session( session ) )
+                        ::shutdown( listen_fd, SHUT_RDWR ); // wakes up accept()
+
+                    {
+                        std::lock_guard<std::mutex> lock( open_mutex );
+                        open_fds.erase( fd );
+                        ::close( fd );
+                    }
+                    done = true;
+                } );
+        }
+
+        // Idle clients would keep their sessions reading forever, end them so they can be joined
+        {
+            std::lock_guard<std::mutex> lock( open_mutex );
+            for( const int fd : open_fds )
+                ::shutdown( fd, SHUT_RDWR );
+        }
+        for( auto &connection : connections )
+            connection.thread.join();
+
+        ::close( listen_fd );
+        ::unlink( path.c_str() );
+        return EXIT_SUCCESS;
+    }
+} // namespace
+
+int run_server( const server_settings_t &settings )
+{
+    // Clients that disconnect before their reply make writes fail instead of killing the server
+    std::signal( SIGPIPE, SIG_IGN );
+
+    std::cerr << "Render server with " << settings.thread_count << " threads, scene cache capacity "
+              << settings.cache_capacity << ", workers pinned " << pin_policy_name( settings.pin_policy ) << '\n';
+
+    if( !settings.trace_path.empty() && !trace_start() )
+        std::cerr << "Built without RAYTRACER_TRACE, --trace is ignored\n";
+
+    std::string perf_error;
+    if( settings.perf_counters && !perf_counters_start( rays_traced_by_thread, perf_error ) )
+        std::cerr << "Performance counters unavailable: " << perf_error << '\n';
+
+    int result = EXIT_SUCCESS;
+    {
+        server_t server( settings );
+
+        if( !settings.socket_path.empty() )
+        {
+            result = serve_socket( server, settings.socket_path );
+        }
+        else
+        {
+            session_t session( STDIN_FILENO, STDOUT_FILENO );
+            server.run_session( session );
+        }
+    }
+
+    if( !settings.trace_path.empty() && trace_start() && !trace_write( settings.trace_path ) )
+        std::cerr << "Cannot write trace to " << settings.trace_path << '\n';
+    perf_counters_report( std::cerr );
+
+    return result;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "thread_pool.hpp"
+
+class server_settings_t
+{
+public:
+    unsigned thread_count{ thread_pool_t::default_thread_count() };
+    size_t cache_capacity{ 4 };
+    std::string socket_path; // read requests from stdin when empty
+    std::string trace_path;  // Chrome trace output, needs a RAYTRACER_TRACE build
+    bool perf_counters{ false }; // hardware counter report on exit, Linux only
+    pin_policy_t pin_policy{ pin_policy_t::none };
+};
+
+// Long running render mode. Each request line is answered with one response line:
+//
+//   render id=<id> scene=<name> out=<file.ppm> [width=192] [height=120] [spp_x=16] [spp_y=16] [depth=50]
+//          [lookfrom=x,y,z] [lookat=x,y,z] [vfov=deg] [aperture=a] [focus=d] [deadline_ms=ms]
+//          [tile_rows=8] [packet_width=8]
+//     -> done id=<id> out=<file.ppm> scene_cached=<0|1> ms=<elapsed>
+//        with deadline_ms also: spp=<min>-<max> depth=<d> passes=<n> rel_error=<e> [overrun_ms=<ms>]
+//        at most 8 deadline requests render at once, time waiting for one of them to finish counts against the deadline
+//     -> error id=<id> <message>
+//   stats    -> stats requests=<n> cache_size=<n> cache_hits=<n> cache_misses=<n> cache_evictions=<n>
+//   quit     -> closes the session
+//   shutdown -> stops accepting new sessions (socket mode)
+int run_server( const server_settings_t &settings );
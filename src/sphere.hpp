@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
 #include <cmath>
 
@@ -40,13 +41,88 @@ public:
 
         rec.t = t;
         rec.p = r.at( rec.t );
+        rec.footprint = r.spread() > 0.0 ? r.spread() * t * sqrt( a ) : 0.0;
         const vec3_t outward_normal = ( rec.p - center_ ) / radius_;
         rec.set_face_normal( r, outward_normal );
         rec.material = material_;
+        rec.object = this;
 
         return true;
     }
 
+    // Latitude and longitude: u goes around the y axis starting at -x, v from the bottom pole to the top one
+    virtual bool texture_coordinates( const hit_record_t &rec, texture_coordinates_t &uv ) const override
+    {
+        const vec3_t outward_normal = ( rec.p - center_ ) / radius_;
+        const auto theta = acos( std::clamp( -outward_normal.y, -1.0, 1.0 ) );
+        const auto phi = atan2( -outward_normal.z, outward_normal.x ) + pi;
+
+        uv.u = phi / ( 2.0 * pi );
+        uv.v = 1.0 - theta / pi;
+        uv.du = rec.footprint / ( 2.0 * pi * radius_ );
+        uv.dv = rec.footprint / ( pi * radius_ );
+        return true;
+    }
+
+    // Uniform over the cone of directions from origin that hit the sphere
+    virtual double pdf_value( const point3_t &origin, const vec3_t &direction ) const override
+    {
+        hit_record_t rec;
+        if( !hit( ray_t( origin, direction ), 0.001, infinity, rec ) )
+            return 0.0;
+
+        const auto distance_squared = length_squared( center_ - origin );
+        if( distance_squared <= radius_ * radius_ )
+            return 0.0;
+
+        const auto cos_theta_max = sqrt( 1.0 - radius_ * radius_ / distance_squared );
+        const auto solid_angle = 2.0 * pi * ( 1.0 - cos_theta_max );
+        return 1.0 / solid_angle;
+    }
+
+    virtual vec3_t random_direction( const point3_t &origin, random_number_generator_t &rng ) const override
+    {
+        const vec3_t direction = center_ - origin;
+        const auto distance_squared = length_squared( direction );
+        if( distance_squared <= radius_ * radius_ )
+            return rng.random_unit_vector();
+
+        // Direction inside the cone around the z axis, then rotated so z points at the center
+        const auto r1 = rng.random_double();
+        const auto r2 = rng.random_double();
+        const auto z = 1.0 + r2 * ( sqrt( 1.0 - radius_ * radius_ / distance_squared ) - 1.0 );
+        const auto phi = 2.0 * pi * r1;
+        const auto x = cos( phi ) * sqrt( 1.0 - z * z );
+        const auto y = sin( phi ) * sqrt( 1.0 - z * z );
+
+        const vec3_t w = unit_vector( direction );
+        const vec3_t a = fabs( w.x ) > 0.9 ? vec3_t{ 0.0, 1.0, 0.0 } : vec3_t{ 1.0, 0.0, 0.0 };
+        const vec3_t v = unit_vector( cross( w, a ) );
+        const vec3_t u = cross( w, v );
+        return x * u + y * v + z * w;
+    }
+
+    virtual aabb_t bounding_box() const override
+    {
+        const vec3_t extent{ radius_, radius_, radius_ };
+        return aabb_t{ center_ - extent, center_ + extent };
+    }
+
+    const point3_t &center() const
+    {
+        return center_;
+    }
+
+    double radius() const
+    {
+        return radius_;
+    }
+
+    const std::shared_ptr<material_t> &material() const
+    {
+        return material_;
+    }
+
 private:
     point3_t center_;
     double radius_;
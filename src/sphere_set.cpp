@@ -0,0 +1,247 @@
+#include <cmath>
+
+#include "sphere_set.hpp"
+#include "trace.hpp"
+
+sphere_set_t::sphere_set_t( size_t count,
+                            sphere_storage_t storage,
+                            const aabb_t &center_bounds,
+                            double max_radius,
+                            std::vector<std::shared_ptr<material_t>> palette )
+    : count( count ),
+      storage_( storage ),
+      center_bounds( center_bounds ),
+      palette( std::move( palette ) )
+{
+    const vec3_t extent = center_bounds.max - center_bounds.min;
+    quantization_step = vec3_t{ extent.x > 0.0 ? extent.x / 65535.0 : 1.0,
+                                extent.y > 0.0 ? extent.y / 65535.0 : 1.0,
+                                extent.z > 0.0 ? extent.z / 65535.0 : 1.0 };
+    radius_step = max_radius > 0.0 ? max_radius / 65535.0 : 1.0;
+
+    if( storage_ == sphere_storage_t::full )
+        full.resize( count );
+    else
+        quantized.resize( count );
+    materials.resize( count );
+}
+
+void sphere_set_t::set( size_t index, const point3_t &center, double radius, uint16_t material )
+{
+    if( storage_ == sphere_storage_t::full )
+    {
+        full[index] = full_sphere_t{ float( center.x ), float( center.y ), float( center.z ), float( radius ) };
+    }
+    else
+    {
+        const auto quantize = []( double value, double min, double step )
+        { return static_cast<uint16_t>( std::lround( std::clamp( ( value - min ) / step, 0.0, 65535.0 ) ) ); };
+
+        quantized[index] = quantized_sphere_t{ quantize( center.x, center_bounds.min.x, quantization_step.x ),
+                                               quantize( center.y, center_bounds.min.y, quantization_step.y ),
+                                               quantize( center.z, center_bounds.min.z, quantization_step.z ),
+                                               quantize( radius, 0.0, radius_step ) };
+    }
+    materials[index] = material < palette.size() ? material : 0;
+}
+
+void sphere_set_t::get( size_t index, point3_t &center, double &radius ) const
+{
+    if( storage_ == sphere_storage_t::full )
+    {
+        const full_sphere_t &s = full[index];
+        center = point3_t{ s.x, s.y, s.z };
+        radius = s.radius;
+    }
+    else
+    {
+        const quantized_sphere_t &s = quantized[index];
+        center = point3_t{ center_bounds.min.x + s.x * quantization_step.x,
+                           center_bounds.min.y + s.y * quantization_step.y,
+                           center_bounds.min.z + s.z * quantization_step.z };
+        radius = s.radius * radius_step;
+    }
+}
+
+template <typename T>
+void sphere_set_t::permute( std::vector<T> &values, const std::vector<uint32_t> &order )
+{
+    if( values.empty() )
+        return;
+
+    std::vector<T> permuted( values.size() );
+    const int64_t n = static_cast<int64_t>( values.size() );
+
+#pragma omp parallel for schedule( static )
+    for( int64_t slot = 0; slot < n; slot++ )
+        permuted[slot] = values[order[slot]];
+
+    values.swap( permuted );
+}
+
+void sphere_set_t::build( int leaf_size )
+{
+    TRACE_SCOPE( "build_bvh" );
+
+    bvh.build( count,
+               leaf_size,
+               [this]( uint32_t i )
+               {
+                   point3_t center;
+                   double radius;
+                   get( i, center, radius );
+                   const vec3_t extent{ radius, radius, radius };
+                   return aabb_t{ center - extent, center + extent };
+               } );
+
+    // Store the spheres in leaf order so leaves address them directly and the order table can go
+    permute( full, bvh.order() );
+    permute( quantized, bvh.order() );
+    permute( materials, bvh.order() );
+    bvh.release_order();
+}
+
+bool sphere_set_t::hit_sphere(
+    uint32_t slot, const ray_t &r, double a, double t_min, double t_max, hit_record_t &rec ) const
+{
+    point3_t center;
+    double radius;
+    get( slot, center, radius );
+
+    const vec3_t oc = r.origin() - center;
+    const auto half_b = dot( oc, r.direction() );
+    const auto c = length_squared( oc ) - radius * radius;
+
+    const auto discriminant = half_b * half_b - a * c;
+    if( discriminant < 0 )
+        return false;
+    const auto sqrtd = sqrt( discriminant );
+
+    // Find the nearest root that lies in the acceptable range.
+    auto t = ( -half_b - sqrtd ) / a;
+    if( t < t_min || t_max < t )
+    {
+        t = ( -half_b + sqrtd ) / a;
+        if( t < t_min || t_max < t )
+            return false;
+    }
+
+    rec.t = t;
+    rec.p = r.at( t );
+    const vec3_t outward_normal = ( rec.p - center ) / radius;
+    rec.set_face_normal( r, outward_normal );
+    rec.material = palette[materials[slot]];
+    rec.object = this;
+    return true;
+}
+
+bool sphere_set_t::hit( const ray_t &r, double t_min, double t_max, hit_record_t &rec ) const
+{
+    const auto a = length_squared( r.direction() );
+
+    return bvh.traverse( r,
+                         t_min,
+                         t_max,
+                         [&]( uint32_t first, uint32_t slot_count, double &closest_so_far )
+                         {
+                             bool hit_anything = false;
+                             for( uint32_t slot = first; slot < first + slot_count; slot++ )
+                             {
+                                 if( hit_sphere( slot, r, a, t_min, closest_so_far, rec ) )
+                                 {
+                                     closest_so_far = rec.t;
+                                     hit_anything = true;
+                                 }
+                             }
+                             return hit_anything;
+                         } );
+}
+
+void sphere_set_t::hit_packet( ray_packet_t &packet, double t_min ) const
+{
+    double a[ray_packet_t::max_size];
+    for( int i = 0; i < packet.size(); i++ )
+        a[i] = length_squared( packet.ray( i ).direction() );
+
+    hit_record_t rec;
+    bvh.traverse_packet( packet,
+                         t_min,
+                         [&]( uint32_t first, uint32_t slot_count )
+                         {
+                             packet.for_each_active(
+                                 [&]( int i )
+                                 {
+                                     for( uint32_t slot = first; slot < first + slot_count; slot++ )
+                                     {
+                                         if( hit_sphere( slot, packet.ray( i ), a[i], t_min, packet.t_max( i ), rec ) )
+                                             packet.set_hit( i, rec );
+                                     }
+                                 } );
+                         } );
+}
+
+bool sphere_set_t::hit_any( const ray_t &r, double t_min, double t_max ) const
+{
+    const point3_t origin = r.origin();
+    const vec3_t direction = r.direction();
+    const auto a = length_squared( direction );
+
+    return bvh.traverse_any( r,
+                             t_min,
+                             t_max,
+                             [&]( uint32_t first, uint32_t slot_count )
+                             {
+                                 for( uint32_t slot = first; slot < first + slot_count; slot++ )
+                                 {
+                                     point3_t center;
+                                     double radius;
+                                     get( slot, center, radius );
+
+                                     const vec3_t oc = origin - center;
+                                     const auto half_b = dot( oc, direction );
+                                     const auto c = length_squared( oc ) - radius * radius;
+                                     const auto discriminant = half_b * half_b - a * c;
+                                     if( discriminant < 0 )
+                                         continue;
+                                     const auto sqrtd = sqrt( discriminant );
+
+                                     const auto t0 = ( -half_b - sqrtd ) / a;
+                                     const auto t1 = ( -half_b + sqrtd ) / a;
+                                     if( ( t0 >= t_min && t0 <= t_max ) || ( t1 >= t_min && t1 <= t_max ) )
+                                         return true;
+                                 }
+                                 return false;
+                             } );
+}
+
+aabb_t sphere_set_t::bounding_box() const
+{
+    return bvh.bounds();
+}
+
+size_t sphere_set_t::memory_bytes() const
+{
+    return full.capacity() * sizeof( full_sphere_t ) + quantized.capacity() * sizeof( quantized_sphere_t )
+           + materials.capacity() * sizeof( uint16_t ) + bvh.memory_bytes();
+}
+
+size_t sphere_set_t::estimate_memory_bytes( size_t count, sphere_storage_t storage, int leaf_size )
+{
+    const size_t per_sphere
+        = ( storage == sphere_storage_t::full ? sizeof( full_sphere_t ) : sizeof( quantized_sphere_t ) )
+          + sizeof( uint16_t );
+    return count * per_sphere + bvh_t::subtree_nodes( count, leaf_size ) * sizeof( bvh_t::node_t );
+}
+
+size_t sphere_set_t::estimate_peak_memory_bytes( size_t count, sphere_storage_t storage, int leaf_size )
+{
+    const size_t storage_bytes
+        = storage == sphere_storage_t::full ? sizeof( full_sphere_t ) : sizeof( quantized_sphere_t );
+    return estimate_memory_bytes( count, storage, leaf_size )
+           + std::max( bvh_t::build_scratch_bytes( count ), bvh_t::order_bytes( count ) + count * storage_bytes );
+}
+
+const char *sphere_set_t::storage_name( sphere_storage_t storage )
+{
+    return storage == sphere_storage_t::full ? "full" : "quantized";
+}
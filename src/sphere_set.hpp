@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hittable.hpp"
+#include "material.hpp"
+#include "bvh.hpp"
+
+enum class sphere_storage_t
+{
+    full,     // float center and radius, 18 bytes per sphere
+    quantized // 16 bit center and radius relative to the set's bounds, 10 bytes per sphere
+};
+
+// Large number of spheres sharing a small material palette, stored as plain arrays instead of one heap object
+// per sphere and indexed by their own bvh_t. Fill every slot with set(), then call build().
+class sphere_set_t : public hittable_t
+{
+public:
+    sphere_set_t( size_t count,
+                  sphere_storage_t storage,
+                  const aabb_t &center_bounds,
+                  double max_radius,
+                  std::vector<std::shared_ptr<material_t>> palette );
+
+    // Safe to call concurrently for different indices
+    void set( size_t index, const point3_t &center, double radius, uint16_t material );
+
+    // Builds the hierarchy and reorders the spheres to match its leaves
+    void build( int leaf_size );
+
+    virtual bool hit( const ray_t &r, double t_min, double t_max, hit_record_t &rec ) const override;
+    virtual bool hit_any( const ray_t &r, double t_min, double t_max ) const override;
+    virtual void hit_packet( ray_packet_t &packet, double t_min ) const override;
+    virtual aabb_t bounding_box() const override;
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    sphere_storage_t storage() const
+    {
+        return storage_;
+    }
+
+    int leaf_size() const
+    {
+        return bvh.leaf_size();
+    }
+
+    size_t memory_bytes() const;
+
+    static size_t estimate_memory_bytes( size_t count, sphere_storage_t storage, int leaf_size );
+
+    // Most memory in use at once while building: estimate_memory_bytes plus the index's build arrays and the copy
+    // of one attribute array that reordering makes
+    static size_t estimate_peak_memory_bytes( size_t count, sphere_storage_t storage, int leaf_size );
+    static const char *storage_name( sphere_storage_t storage );
+
+private:
+    struct full_sphere_t
+    {
+        float x, y, z, radius;
+    };
+
+    struct quantized_sphere_t
+    {
+        uint16_t x, y, z, radius;
+    };
+
+    void get( size_t index, point3_t &center, double &radius ) const;
+
+    // a is the squared length of the ray direction
+    bool hit_sphere( uint32_t slot, const ray_t &r, double a, double t_min, double t_max, hit_record_t &rec ) const;
+
+    template <typename T>
+    static void permute( std::vector<T> &values, const std::vector<uint32_t> &order );
+
+private:
+    size_t count;
+    sphere_storage_t storage_;
+    aabb_t center_bounds;
+    vec3_t quantization_step;
+    double radius_step;
+
+    std::vector<full_sphere_t> full;
+    std::vector<quantized_sphere_t> quantized;
+    std::vector<uint16_t> materials;
+    std::vector<std::shared_ptr<material_t>> palette;
+
+    bvh_t bvh;
+};
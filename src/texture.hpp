@@ -0,0 +1,34 @@
+#pragma once
+
+#include <memory>
+
+#include "hit_record.hpp"
+#include "hittable.hpp"
+#include "texture_cache.hpp"
+#include "vec3.hpp"
+
+class texture_t
+{
+public:
+    virtual color_t value( const hit_record_t &rec ) const = 0;
+};
+
+// Image from a texture cache, mapped by the texture coordinates of the object that was hit. Objects without a
+// mapping see the color at ( 0, 0 ).
+class image_texture_t : public texture_t
+{
+public:
+    image_texture_t( std::shared_ptr<const texture_cache_t> cache, int id ) : cache( std::move( cache ) ), id( id ) { }
+
+    virtual color_t value( const hit_record_t &rec ) const override
+    {
+        texture_coordinates_t uv;
+        if( rec.object )
+            rec.object->texture_coordinates( rec, uv );
+        return cache->sample( id, uv );
+    }
+
+private:
+    std::shared_ptr<const texture_cache_t> cache;
+    int id;
+};
@@ -0,0 +1,544 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "texture_cache.hpp"
+#include "trace.hpp"
+
+namespace
+{
+    // Reader slots are handed out per thread and returned when the thread ends, so pools that come and go reuse them
+    class reader_index_t
+    {
+    public:
+        reader_index_t()
+        {
+            std::lock_guard<std::mutex> lock( free_mutex() );
+            auto &free = free_indices();
+            if( !free.empty() )
+            {
+                index = free.back();
+                free.pop_back();
+            }
+            else
+            {
+                index = next_index()++;
+            }
+        }
+
+        ~reader_index_t()
+        {
+            std::lock_guard<std::mutex> lock( free_mutex() );
+            free_indices().push_back( index );
+        }
+
+        int index;
+
+    private:
+        static std::mutex &free_mutex()
+        {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        static std::vector<int> &free_indices()
+        {
+            static std::vector<int> indices;
+            return indices;
+        }
+
+        static int &next_index()
+        {
+            static int next = 0;
+            return next;
+        }
+    };
+
+    thread_local reader_index_t reader_index;
+
+    // Texels are stored as in the file, squaring approximates the gamma 2 that write_color applies
+    const double *byte_to_linear()
+    {
+        static const auto table = []
+        {
+            std::vector<double> values( 256 );
+            for( int i = 0; i < 256; i++ )
+                values[i] = ( i / 255.0 ) * ( i / 255.0 );
+            return values;
+        }();
+        return table.data();
+    }
+
+    // Skips whitespace and # comments of a PPM header
+    size_t skip_space( const uint8_t *data, size_t size, size_t pos )
+    {
+        while( pos < size )
+        {
+            if( data[pos] == '#' )
+            {
+                while( pos < size && data[pos] != '\n' )
+                    pos++;
+            }
+            else if( std::isspace( data[pos] ) )
+            {
+                pos++;
+            }
+            else
+            {
+                break;
+            }
+        }
+        return pos;
+    }
+
+    bool read_number( const uint8_t *data, size_t size, size_t &pos, int &value )
+    {
+        pos = skip_space( data, size, pos );
+        if( pos >= size || !std::isdigit( data[pos] ) )
+            return false;
+
+        int64_t number = 0;
+        while( pos < size && std::isdigit( data[pos] ) && number < ( int64_t( 1 ) << 31 ) )
+            number = number * 10 + ( data[pos++] - '0' );
+        value = static_cast<int>( std::min<int64_t>( number, ( int64_t( 1 ) << 31 ) - 1 ) );
+        return true;
+    }
+
+    // Shared writable mapping of a new temporary file that is already unlinked, nullptr on failure
+    uint8_t *map_scratch_file( size_t size )
+    {
+        const char *directory = std::getenv( "TMPDIR" );
+        std::string path = std::string( directory && *directory ? directory : "/tmp" ) + "/raytracer-mips-XXXXXX";
+
+        const int fd = ::mkstemp( &path[0] );
+        if( fd < 0 )
+            return nullptr;
+        ::unlink( path.c_str() );
+
+        void *mapping = MAP_FAILED;
+        if( ::ftruncate( fd, static_cast<off_t>( size ) ) == 0 )
+            mapping = ::mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        ::close( fd );
+        return mapping == MAP_FAILED ? nullptr : static_cast<uint8_t *>( mapping );
+    }
+
+    // Marks the calling thread as reading from the cache for the lifetime of the object
+    class read_section_t
+    {
+    public:
+        read_section_t( std::atomic<uint64_t> *reader_epoch, const std::atomic<uint64_t> &epoch )
+            : reader_epoch( reader_epoch )
+        {
+            if( reader_epoch )
+                reader_epoch->store( epoch.load() );
+        }
+
+        ~read_section_t()
+        {
+            if( reader_epoch )
+                reader_epoch->store( 0, std::memory_order_release );
+        }
+
+        read_section_t( const read_section_t & ) = delete;
+        read_section_t &operator=( const read_section_t & ) = delete;
+
+    private:
+        std::atomic<uint64_t> *reader_epoch;
+    };
+} // namespace
+
+texture_cache_t::texture_cache_t( size_t capacity_bytes, int tile_size )
+    : tile_size( std::max( 8, tile_size ) ),
+      capacity( capacity_bytes )
+{
+}
+
+texture_cache_t::~texture_cache_t()
+{
+    for( tile_t *tile : resident )
+        delete tile;
+    for( const auto &r : retired )
+        delete r.tile;
+    for( const auto &texture : textures )
+    {
+        ::munmap( texture->mapping, texture->mapping_size );
+        if( texture->mips )
+            ::munmap( texture->mips, texture->mips_size );
+    }
+}
+
+int texture_cache_t::open( const std::string &path )
+{
+    TRACE_SCOPE( "open_texture" );
+
+    const int fd = ::open( path.c_str(), O_RDONLY );
+    if( fd < 0 )
+        return -1;
+
+    struct stat info;
+    if( ::fstat( fd, &info ) != 0 || info.st_size <= 0 )
+    {
+        ::close( fd );
+        return -1;
+    }
+
+    const size_t size = static_cast<size_t>( info.st_size );
+    void *mapping = ::mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    ::close( fd );
+    if( mapping == MAP_FAILED )
+        return -1;
+
+    const auto *data = static_cast<const uint8_t *>( mapping );
+    size_t pos = 2;
+    int width = 0;
+    int height = 0;
+    int max_value = 0;
+    const bool header_ok = size > 2 && data[0] == 'P' && data[1] == '6' && read_number( data, size, pos, width )
+                           && read_number( data, size, pos, height ) && read_number( data, size, pos, max_value )
+                           && pos < size && std::isspace( data[pos] );
+
+    // One whitespace byte separates the header from the pixels
+    if( !header_ok || width <= 0 || height <= 0 || max_value != 255
+        || size - pos - 1 < size_t( width ) * size_t( height ) * 3 )
+    {
+        ::munmap( mapping, size );
+        return -1;
+    }
+
+    // Tiles are read in rectangles scattered over the file, read ahead would mostly fetch unused rows
+    ::madvise( mapping, size, MADV_RANDOM );
+
+    auto texture = std::make_unique<texture_t>();
+    texture->path = path;
+    texture->mapping = mapping;
+    texture->mapping_size = size;
+    texture->pixels = data + pos + 1;
+
+    size_t slot_count = 0;
+    int level_width = width;
+    int level_height = height;
+    while( true )
+    {
+        const int tiles_x = ( level_width + tile_size - 1 ) / tile_size;
+        const int tiles_y = ( level_height + tile_size - 1 ) / tile_size;
+        texture->levels.push_back( level_t{ level_width, level_height, tiles_x, slot_count } );
+        slot_count += size_t( tiles_x ) * tiles_y;
+
+        if( level_width == 1 && level_height == 1 )
+            break;
+        level_width = ( level_width + 1 ) / 2;
+        level_height = ( level_height + 1 ) / 2;
+    }
+
+    texture->slots = std::make_unique<std::atomic<tile_t *>[]>( slot_count );
+    for( size_t i = 0; i < slot_count; i++ )
+        texture->slots[i].store( nullptr, std::memory_order_relaxed );
+
+    // Coarser levels go to an unlinked scratch file the kernel can page out. Without one they are rebuilt from the
+    // finer level after every eviction, which still works but gets slow once the cache is much smaller than them.
+    if( texture->levels.size() > 1 )
+    {
+        const size_t mip_tiles = slot_count - texture->levels[1].first_slot;
+        texture->mips_size = mip_tiles * size_t( tile_size ) * tile_size * 3;
+        texture->mips = map_scratch_file( texture->mips_size );
+        texture->mip_written = std::make_unique<std::atomic<bool>[]>( mip_tiles );
+        for( size_t i = 0; i < mip_tiles; i++ )
+            texture->mip_written[i].store( false, std::memory_order_relaxed );
+    }
+
+    std::lock_guard<std::recursive_mutex> lock( mutex );
+    texture->id = static_cast<uint32_t>( textures.size() );
+    textures.push_back( std::move( texture ) );
+    return static_cast<int>( textures.size() - 1 );
+}
+
+int texture_cache_t::width( int texture ) const
+{
+    return textures[texture]->levels[0].width;
+}
+
+int texture_cache_t::height( int texture ) const
+{
+    return textures[texture]->levels[0].height;
+}
+
+texture_cache_t::reader_t *texture_cache_t::this_reader() const
+{
+    const int index = reader_index.index;
+    return index < max_readers ? &readers[index] : nullptr;
+}
+
+color_t texture_cache_t::sample( int texture_id, const texture_coordinates_t &uv ) const
+{
+    const texture_t &texture = *textures[texture_id];
+    reader_t *reader = this_reader();
+
+    // Threads without a reader slot hold the mutex instead, which keeps eviction from freeing tiles under them
+    std::unique_lock<std::recursive_mutex> lock( mutex, std::defer_lock );
+    if( !reader )
+    {
+        lock.lock();
+        locked_readers++;
+    }
+    read_section_t section( reader ? &reader->epoch : nullptr, epoch );
+
+    // Coarsest level whose texels are no larger than the footprint
+    const level_t &finest = texture.levels[0];
+    const double footprint = std::max( uv.du * finest.width, uv.dv * finest.height );
+    int level = 0;
+    if( footprint > 1.0 )
+        level = std::min( static_cast<int>( std::log2( footprint ) ), static_cast<int>( texture.levels.size() ) - 1 );
+
+    const level_t &l = texture.levels[level];
+    const double x = ( uv.u - std::floor( uv.u ) ) * l.width - 0.5;
+    const double y = ( 1.0 - std::clamp( uv.v, 0.0, 1.0 ) ) * l.height - 0.5;
+    const double x0 = std::floor( x );
+    const double y0 = std::floor( y );
+    const double fx = x - x0;
+    const double fy = y - y0;
+
+    const auto wrap_x = [&l]( int i ) { return ( i % l.width + l.width ) % l.width; };
+    const auto clamp_y = [&l]( int i ) { return std::clamp( i, 0, l.height - 1 ); };
+    const int ix0 = wrap_x( static_cast<int>( x0 ) );
+    const int ix1 = wrap_x( static_cast<int>( x0 ) + 1 );
+    const int iy0 = clamp_y( static_cast<int>( y0 ) );
+    const int iy1 = clamp_y( static_cast<int>( y0 ) + 1 );
+
+    const vec3_t top
+        = ( 1.0 - fx ) * texel( texture, level, ix0, iy0, reader ) + fx * texel( texture, level, ix1, iy0, reader );
+    const vec3_t bottom
+        = ( 1.0 - fx ) * texel( texture, level, ix0, iy1, reader ) + fx * texel( texture, level, ix1, iy1, reader );
+    if( !reader )
+        locked_readers--;
+    return ( 1.0 - fy ) * top + fy * bottom;
+}
+
+vec3_t texture_cache_t::texel( const texture_t &texture, int level, int x, int y, reader_t *reader ) const
+{
+    const tile_t *tile = find_tile( texture, level, x / tile_size, y / tile_size, reader );
+    const uint8_t *rgb = &tile->texels[( size_t( y % tile_size ) * tile_size + x % tile_size ) * 3];
+    const double *linear = byte_to_linear();
+    return vec3_t{ linear[rgb[0]], linear[rgb[1]], linear[rgb[2]] };
+}
+
+const texture_cache_t::tile_t *
+texture_cache_t::find_tile( const texture_t &texture, int level, int tile_x, int tile_y, reader_t *reader ) const
+{
+    const level_t &l = texture.levels[level];
+    const size_t slot = l.first_slot + size_t( tile_y ) * l.tiles_x + size_t( tile_x );
+
+    tile_t *tile = texture.slots[slot].load();
+    if( !tile )
+        tile = load_tile( texture, level, slot, reader );
+
+    // Only this thread writes its counter
+    if( reader )
+        reader->lookups.store( reader->lookups.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+    else
+        locked_lookups++;
+
+    // Only write the stamp when it changes, hot tiles stay shared between the cores' caches
+    const uint64_t now = clock.load( std::memory_order_relaxed );
+    if( tile->last_used.load( std::memory_order_relaxed ) != now )
+        tile->last_used.store( now, std::memory_order_relaxed );
+
+    return tile;
+}
+
+texture_cache_t::tile_t *
+texture_cache_t::load_tile( const texture_t &texture, int level, size_t slot, reader_t *reader ) const
+{
+    TRACE_SCOPE_ARG( "load_tile", level );
+
+    const level_t &l = texture.levels[level];
+    const size_t index = slot - l.first_slot;
+    const int tile_x = static_cast<int>( index % l.tiles_x );
+    const int tile_y = static_cast<int>( index / l.tiles_x );
+
+    // Decode without holding the mutex, two threads may decode the same tile and the second one is dropped
+    auto texels = std::make_unique<uint8_t[]>( size_t( tile_size ) * tile_size * 3 );
+
+    if( level == 0 )
+    {
+        for( int y = 0; y < tile_size; y++ )
+        {
+            const int source_y = std::min( tile_y * tile_size + y, l.height - 1 );
+            for( int x = 0; x < tile_size; x++ )
+            {
+                const int source_x = std::min( tile_x * tile_size + x, l.width - 1 );
+                std::memcpy( &texels[( size_t( y ) * tile_size + x ) * 3],
+                             texture.pixels + ( size_t( source_y ) * l.width + source_x ) * 3,
+                             3 );
+            }
+        }
+    }
+    else if( texture.mips && texture.mip_written[slot - texture.levels[1].first_slot].load() )
+    {
+        const size_t tile_bytes = size_t( tile_size ) * tile_size * 3;
+        std::memcpy( texels.get(), texture.mips + ( slot - texture.levels[1].first_slot ) * tile_bytes, tile_bytes );
+    }
+    else
+    {
+        // The tile covers 2 x 2 tiles of the finer level. Fetch them once, the read section keeps them alive even
+        // if loading one of them evicts another, so a small cache cannot make this recurse over and over.
+        const level_t &finer = texture.levels[level - 1];
+        const int finer_tiles_y = ( finer.height + tile_size - 1 ) / tile_size;
+        const tile_t *sources[2][2];
+        for( int j = 0; j < 2; j++ )
+        {
+            for( int i = 0; i < 2; i++ )
+            {
+                const int source_x = std::min( tile_x * 2 + i, finer.tiles_x - 1 );
+                const int source_y = std::min( tile_y * 2 + j, finer_tiles_y - 1 );
+                sources[j][i] = find_tile( texture, level - 1, source_x, source_y, reader );
+            }
+        }
+
+        const double *linear = byte_to_linear();
+        const auto finer_texel = [&]( int x, int y )
+        {
+            x = std::min( x, finer.width - 1 );
+            y = std::min( y, finer.height - 1 );
+            const tile_t *source = sources[y / tile_size - tile_y * 2][x / tile_size - tile_x * 2];
+            const uint8_t *rgb = &source->texels[( size_t( y % tile_size ) * tile_size + x % tile_size ) * 3];
+            return vec3_t{ linear[rgb[0]], linear[rgb[1]], linear[rgb[2]] };
+        };
+
+        for( int y = 0; y < tile_size; y++ )
+        {
+            const int source_y = std::min( tile_y * tile_size + y, l.height - 1 ) * 2;
+            for( int x = 0; x < tile_size; x++ )
+            {
+                // Box filter of the finer level, clamped at its border when its size is odd
+                const int source_x = std::min( tile_x * tile_size + x, l.width - 1 ) * 2;
+                const vec3_t sum = finer_texel( source_x, source_y ) + finer_texel( source_x + 1, source_y )
+                                   + finer_texel( source_x, source_y + 1 ) + finer_texel( source_x + 1, source_y + 1 );
+
+                // Averaged in linear space, stored with the gamma of the file
+                const double channels[3] = { sum.x / 4.0, sum.y / 4.0, sum.z / 4.0 };
+                uint8_t *out = &texels[( size_t( y ) * tile_size + x ) * 3];
+                for( int c = 0; c < 3; c++ )
+                {
+                    const double value = std::sqrt( std::clamp( channels[c], 0.0, 1.0 ) );
+                    out[c] = static_cast<uint8_t>( std::lround( value * 255.0 ) );
+                }
+            }
+        }
+    }
+
+    std::lock_guard<std::recursive_mutex> lock( mutex );
+
+    tile_t *existing = texture.slots[slot].load();
+    if( existing )
+        return existing;
+
+    if( level > 0 && texture.mips )
+    {
+        const size_t mip_index = slot - texture.levels[1].first_slot;
+        if( !texture.mip_written[mip_index].load() )
+        {
+            const size_t tile_bytes = size_t( tile_size ) * tile_size * 3;
+            std::memcpy( texture.mips + mip_index * tile_bytes, texels.get(), tile_bytes );
+            texture.mip_written[mip_index].store( true );
+        }
+    }
+
+    auto *tile = new tile_t;
+    tile->texels = std::move( texels );
+    tile->texture = texture.id;
+    tile->slot = static_cast<uint32_t>( slot );
+    tile->last_used.store( clock.fetch_add( 1 ) + 1, std::memory_order_relaxed );
+
+    misses++;
+    bytes += tile_bytes();
+    peak_bytes = std::max( peak_bytes, bytes );
+    resident.push_back( tile );
+    texture.slots[slot].store( tile );
+
+    if( bytes > capacity )
+        evict_locked();
+    reclaim_locked();
+
+    return tile;
+}
+
+void texture_cache_t::evict_locked() const
+{
+    TRACE_SCOPE( "evict_tiles" );
+
+    // Evict down to 7/8 of the capacity at once so the sort is paid for by many loads
+    const size_t target = capacity / 8 * 7;
+
+    // Readers keep stamping tiles while this runs, sort a snapshot so the order stays consistent
+    std::vector<std::pair<uint64_t, tile_t *>> by_age;
+    by_age.reserve( resident.size() );
+    for( tile_t *tile : resident )
+        by_age.emplace_back( tile->last_used.load( std::memory_order_relaxed ), tile );
+    std::sort( by_age.begin(), by_age.end() );
+
+    // Keep at least the newest tile, usually the one just loaded. Its loader may still be reading it either way, the
+    // read section protects it.
+    size_t evicted = 0;
+    while( evicted + 1 < by_age.size() && bytes - retired.size() * tile_bytes() > target )
+    {
+        tile_t *tile = by_age[evicted++].second;
+        textures[tile->texture]->slots[tile->slot].store( nullptr );
+        retired.push_back( retired_tile_t{ tile, epoch.load() } );
+        evictions++;
+    }
+
+    resident.clear();
+    for( size_t i = evicted; i < by_age.size(); i++ )
+        resident.push_back( by_age[i].second );
+
+    // Lookups that start from now on cannot find the evicted tiles anymore
+    epoch.fetch_add( 1 );
+}
+
+void texture_cache_t::reclaim_locked() const
+{
+    if( retired.empty() || locked_readers > 0 )
+        return;
+
+    uint64_t oldest = UINT64_MAX;
+    for( const reader_t &reader : readers )
+    {
+        const uint64_t e = reader.epoch.load();
+        if( e != 0 )
+            oldest = std::min( oldest, e );
+    }
+
+    // A tile retired in epoch e may still be used by lookups that started in e or before
+    auto freed = std::partition( retired.begin(),
+                                 retired.end(),
+                                 [oldest]( const retired_tile_t &r ) { return r.epoch >= oldest; } );
+    for( auto it = freed; it != retired.end(); ++it )
+    {
+        delete it->tile;
+        bytes -= tile_bytes();
+    }
+    retired.erase( freed, retired.end() );
+}
+
+texture_cache_t::stats_t texture_cache_t::stats() const
+{
+    std::lock_guard<std::recursive_mutex> lock( mutex );
+
+    stats_t s;
+    s.lookups = locked_lookups;
+    for( const reader_t &reader : readers )
+        s.lookups += reader.lookups.load( std::memory_order_relaxed );
+    s.misses = misses;
+    s.evictions = evictions;
+    s.bytes = bytes;
+    s.peak_bytes = peak_bytes;
+    s.capacity_bytes = capacity;
+    return s;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "hit_record.hpp"
+#include "vec3.hpp"
+
+// Image textures that together may be far larger than memory. Binary PPM files are memory mapped, every mip level
+// is cut into square tiles that are decoded on first use and the decoded tiles are kept under a memory cap, evicting
+// the least recently used ones first. Coarser levels are box filtered from the finer one the first time they are
+// needed and written to a memory mapped scratch file, so reloading an evicted one is a copy as for the finest level.
+//
+// Lookups from render threads take no locks: tiles are published through atomic pointers and an evicted tile is
+// only freed once every lookup that could still see it has finished (epoch based reclamation). Loading a missing
+// tile takes the cache mutex to publish it.
+class texture_cache_t
+{
+public:
+    class stats_t
+    {
+    public:
+        uint64_t lookups{ 0 }; // tile lookups, a bilinear sample needs one to four
+        uint64_t misses{ 0 };  // tiles that had to be decoded
+        uint64_t evictions{ 0 };
+        size_t bytes{ 0 }; // decoded tiles, including evicted ones not freed yet
+        size_t peak_bytes{ 0 };
+        size_t capacity_bytes{ 0 };
+
+        double hit_rate() const
+        {
+            return lookups > 0 ? 1.0 - double( misses ) / lookups : 1.0;
+        }
+    };
+
+    explicit texture_cache_t( size_t capacity_bytes, int tile_size = 64 );
+    ~texture_cache_t();
+
+    texture_cache_t( const texture_cache_t & ) = delete;
+    texture_cache_t &operator=( const texture_cache_t & ) = delete;
+
+    // Maps a binary PPM file ( P6, 8 bit ), returns the texture id or -1 if it cannot be read. Open all textures
+    // before rendering, lookups do not expect the list to change.
+    int open( const std::string &path );
+
+    // Bilinear filtered color at ( u, v ) from the mip level whose texels match the footprint du x dv. u wraps around,
+    // v is clamped, v = 1 is the top row of the image.
+    color_t sample( int texture, const texture_coordinates_t &uv ) const;
+
+    int width( int texture ) const;
+    int height( int texture ) const;
+
+    stats_t stats() const;
+
+private:
+    struct tile_t
+    {
+        std::unique_ptr<uint8_t[]> texels; // tile_size x tile_size RGB
+        std::atomic<uint64_t> last_used{ 0 };
+        uint32_t texture;
+        uint32_t slot;
+    };
+
+    struct level_t
+    {
+        int width;
+        int height;
+        int tiles_x;
+        size_t first_slot;
+    };
+
+    struct texture_t
+    {
+        uint32_t id;
+        std::string path;
+        void *mapping{ nullptr };
+        size_t mapping_size{ 0 };
+        const uint8_t *pixels{ nullptr }; // level 0, rows top to bottom
+        uint8_t *mips{ nullptr };         // scratch file with the tiles of levels 1 and up, nullptr if unavailable
+        size_t mips_size{ 0 };
+        std::unique_ptr<std::atomic<bool>[]> mip_written; // per tile of levels 1 and up
+        std::vector<level_t> levels;
+        std::unique_ptr<std::atomic<tile_t *>[]> slots; // tiles of all levels, nullptr while not loaded
+    };
+
+    // One per thread that ever sampled, on its own cache line
+    struct alignas( 64 ) reader_t
+    {
+        std::atomic<uint64_t> epoch{ 0 }; // epoch the running lookup started in, 0 when idle
+        std::atomic<uint64_t> lookups{ 0 };
+    };
+
+    struct retired_tile_t
+    {
+        tile_t *tile;
+        uint64_t epoch;
+    };
+
+    static constexpr int max_readers = 256;
+
+    // Must run inside a read section, which keeps the returned tile alive until it ends
+    vec3_t texel( const texture_t &texture, int level, int x, int y, reader_t *reader ) const;
+    const tile_t *find_tile( const texture_t &texture, int level, int tile_x, int tile_y, reader_t *reader ) const;
+    tile_t *load_tile( const texture_t &texture, int level, size_t slot, reader_t *reader ) const;
+    void evict_locked() const;
+    void reclaim_locked() const;
+    reader_t *this_reader() const;
+
+    size_t tile_bytes() const
+    {
+        return size_t( tile_size ) * tile_size * 3 + sizeof( tile_t );
+    }
+
+private:
+    std::vector<std::unique_ptr<texture_t>> textures;
+    int tile_size;
+    size_t capacity;
+
+    mutable std::recursive_mutex mutex; // loading, eviction, and lookups of threads beyond max_readers
+    mutable std::vector<tile_t *> resident;
+    mutable std::vector<retired_tile_t> retired;
+    mutable size_t bytes{ 0 };
+    mutable size_t peak_bytes{ 0 };
+    mutable uint64_t misses{ 0 };
+    mutable uint64_t locked_lookups{ 0 }; // of threads beyond max_readers
+    mutable int locked_readers{ 0 };      // threads beyond max_readers inside sample(), nothing is freed meanwhile
+    mutable uint64_t evictions{ 0 };
+
+    mutable std::atomic<uint64_t> epoch{ 1 };
+    mutable std::atomic<uint64_t> clock{ 1 }; // advances with every load, stamps tiles for eviction order
+    mutable reader_t readers[max_readers];
+};
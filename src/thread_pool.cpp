@@ -0,0 +1,128 @@
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+namespace
+{
+    thread_local int pinned_node = -1;
+} // namespace
+
+thread_pool_t::thread_pool_t( unsigned thread_count, pin_policy_t policy, const std::string &name )
+{
+    if( thread_count == 0 )
+        thread_count = 1;
+
+    const std::vector<int> cpus = cpu_topology_t::machine().assign( policy, thread_count );
+
+    workers.reserve( thread_count );
+    for( unsigned i = 0; i < thread_count; i++ )
+    {
+        const int cpu = cpus.empty() ? -1 : cpus[i];
+        workers.emplace_back( [this, cpu, name = name + ' ' + std::to_string( i )] { worker_loop( name, cpu ); } );
+    }
+}
+
+thread_pool_t::~thread_pool_t()
+{
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        stopping = true;
+    }
+    work_available.notify_all();
+
+    for( auto &worker : workers )
+        worker.join();
+}
+
+unsigned thread_pool_t::default_thread_count()
+{
+    const unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+int thread_pool_t::worker_node()
+{
+    return pinned_node >= 0 ? pinned_node : current_node();
+}
+
+std::future<void> thread_pool_t::submit( std::vector<task_t> tasks, std::function<void()> on_complete )
+{
+    auto batch = std::make_shared<batch_t>();
+    batch->pending.assign( std::make_move_iterator( tasks.begin() ), std::make_move_iterator( tasks.end() ) );
+    batch->remaining = batch->pending.size();
+    batch->on_complete = std::move( on_complete );
+
+    auto future = batch->done.get_future();
+
+    if( batch->remaining == 0 )
+    {
+        if( batch->on_complete )
+            batch->on_complete();
+        batch->done.set_value();
+        return future;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        active.push_back( batch );
+    }
+    work_available.notify_all();
+
+    return future;
+}
+
+void thread_pool_t::run( std::vector<task_t> tasks )
+{
+    submit( std::move( tasks ) ).get();
+}
+
+void thread_pool_t::worker_loop( const std::string &name, int cpu )
+{
+    trace_set_thread_name( name );
+
+    // Pinned before the first task, so everything the worker allocates and touches lands on its node
+    if( cpu >= 0 && pin_current_thread( { cpu } ) )
+        pinned_node = cpu_topology_t::machine().node_of_cpu( cpu );
+
+    while( true )
+    {
+        std::shared_ptr<batch_t> batch;
+        task_t task;
+
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            work_available.wait( lock, [this] { return stopping || !active.empty(); } );
+
+            if( active.empty() )
+                return;
+
+            // Take one task from the batch at the front and move that batch to the back of the queue
+            batch = active.front();
+            active.pop_front();
+
+            task = std::move( batch->pending.front() );
+            batch->pending.pop_front();
+
+            if( !batch->pending.empty() )
+                active.push_back( batch );
+        }
+
+        task();
+        finish_task( batch );
+    }
+}
+
+void thread_pool_t::finish_task( const std::shared_ptr<batch_t> &batch )
+{
+    bool last;
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        last = --batch->remaining == 0;
+    }
+
+    if( last )
+    {
+        if( batch->on_complete )
+            batch->on_complete();
+        batch->done.set_value();
+    }
+}
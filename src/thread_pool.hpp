@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "topology.hpp"
+
+// Fixed set of worker threads shared by every render. Work is submitted in batches (one batch per image) and
+// workers take one task at a time from each active batch in turn, so a large render cannot starve a small one
+// that was submitted after it. Workers can be pinned to CPUs by a pin_policy_t.
+class thread_pool_t
+{
+public:
+    using task_t = std::function<void()>;
+
+    // name prefixes the workers' trace tracks
+    explicit thread_pool_t( unsigned thread_count,
+                            pin_policy_t policy = pin_policy_t::none,
+                            const std::string &name = "worker" );
+    ~thread_pool_t();
+
+    thread_pool_t( const thread_pool_t & ) = delete;
+    thread_pool_t &operator=( const thread_pool_t & ) = delete;
+
+    // on_complete runs on the worker that finishes the last task, before the returned future becomes ready
+    std::future<void> submit( std::vector<task_t> tasks, std::function<void()> on_complete = {} );
+
+    // Submits the tasks and blocks until all of them are done
+    void run( std::vector<task_t> tasks );
+
+    unsigned size() const
+    {
+        return static_cast<unsigned>( workers.size() );
+    }
+
+    static unsigned default_thread_count();
+
+    // NUMA node of the calling thread: the node a worker is pinned to, otherwise the one it runs on right now
+    static int worker_node();
+
+private:
+    struct batch_t
+    {
+        std::deque<task_t> pending;
+        size_t remaining;
+        std::function<void()> on_complete;
+        std::promise<void> done;
+    };
+
+    void worker_loop( const std::string &name, int cpu );
+    void finish_task( const std::shared_ptr<batch_t> &batch );
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::deque<std::shared_ptr<batch_t>> active; // batches with pending tasks, in round-robin order
+    bool stopping{ false };
+};
@@ -0,0 +1,274 @@
+#include "topology.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+#if defined( __linux__ )
+#    include <dirent.h>
+#    include <pthread.h>
+#    include <sched.h>
+#endif
+
+namespace
+{
+    // "0-3,8,10-11"
+    std::vector<int> parse_cpu_list( const std::string &text )
+    {
+        std::vector<int> cpus;
+        std::istringstream in( text );
+        std::string range;
+        while( std::getline( in, range, ',' ) )
+        {
+            try
+            {
+                const auto dash = range.find( '-' );
+                const int first = std::stoi( range.substr( 0, dash ) );
+                const int last = dash == std::string::npos ? first : std::stoi( range.substr( dash + 1 ) );
+                for( int cpu = first; cpu <= last; cpu++ )
+                    cpus.push_back( cpu );
+            }
+            catch( const std::exception & )
+            {
+            }
+        }
+        return cpus;
+    }
+
+    bool read_line( const std::string &path, std::string &line )
+    {
+        std::ifstream in( path );
+        return bool( std::getline( in, line ) );
+    }
+
+    int read_int( const std::string &path, int fallback )
+    {
+        std::string line;
+        if( !read_line( path, line ) )
+            return fallback;
+        try
+        {
+            return std::stoi( line );
+        }
+        catch( const std::exception & )
+        {
+            return fallback;
+        }
+    }
+
+    // Ids of the node<N> directories
+    std::vector<int> list_nodes( const std::string &node_dir )
+    {
+        std::vector<int> nodes;
+#if defined( __linux__ )
+        DIR *dir = opendir( node_dir.c_str() );
+        if( !dir )
+            return nodes;
+        while( const dirent *entry = readdir( dir ) )
+        {
+            const std::string name = entry->d_name;
+            if( name.size() > 4 && name.compare( 0, 4, "node" ) == 0
+                && name.find_first_not_of( "0123456789", 4 ) == std::string::npos )
+                nodes.push_back( std::stoi( name.substr( 4 ) ) );
+        }
+        closedir( dir );
+        std::sort( nodes.begin(), nodes.end() );
+#endif
+        return nodes;
+    }
+} // namespace
+
+bool parse_pin_policy( const std::string &name, pin_policy_t &policy )
+{
+    for( const pin_policy_t p : { pin_policy_t::none, pin_policy_t::compact, pin_policy_t::scatter } )
+    {
+        if( name == pin_policy_name( p ) )
+        {
+            policy = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *pin_policy_name( pin_policy_t policy )
+{
+    switch( policy )
+    {
+    case pin_policy_t::compact:
+        return "compact";
+    case pin_policy_t::scatter:
+        return "scatter";
+    default:
+        return "none";
+    }
+}
+
+cpu_topology_t cpu_topology_t::detect( const std::string &sys_root )
+{
+    cpu_topology_t topology;
+
+    std::string online;
+    std::vector<int> ids;
+    if( read_line( sys_root + "/cpu/online", online ) )
+        ids = parse_cpu_list( online );
+
+#if defined( __linux__ )
+    // Only the CPUs this process is allowed on, unless reading a recorded topology
+    cpu_set_t allowed;
+    if( sys_root == "/sys/devices/system" && sched_getaffinity( 0, sizeof( allowed ), &allowed ) == 0 )
+        ids.erase( std::remove_if( ids.begin(), ids.end(), [&]( int id ) { return !CPU_ISSET( id, &allowed ); } ),
+                   ids.end() );
+#endif
+
+    std::map<int, int> node_of;
+    const std::vector<int> nodes = list_nodes( sys_root + "/node" );
+    for( size_t n = 0; n < nodes.size(); n++ )
+    {
+        std::string list;
+        if( !read_line( sys_root + "/node/node" + std::to_string( nodes[n] ) + "/cpulist", list ) )
+            continue;
+        for( const int cpu : parse_cpu_list( list ) )
+            node_of[cpu] = static_cast<int>( n );
+    }
+
+    for( const int id : ids )
+    {
+        const std::string dir = sys_root + "/cpu/cpu" + std::to_string( id ) + "/topology/";
+        const auto node = node_of.find( id );
+        topology.cpus_.push_back( cpu_t{ id,
+                                         read_int( dir + "core_id", id ),
+                                         std::max( 0, read_int( dir + "physical_package_id", 0 ) ),
+                                         node == node_of.end() ? 0 : node->second } );
+    }
+
+    if( topology.cpus_.empty() )
+    {
+        const int count = static_cast<int>( std::max( 1u, std::thread::hardware_concurrency() ) );
+        for( int id = 0; id < count; id++ )
+            topology.cpus_.push_back( cpu_t{ id, id, 0, 0 } );
+    }
+
+    // Renumber the nodes that have usable CPUs densely
+    std::set<int> used;
+    for( const auto &cpu : topology.cpus_ )
+        used.insert( cpu.node );
+    std::map<int, int> dense;
+    for( const int node : used )
+        dense.emplace( node, static_cast<int>( dense.size() ) );
+    for( auto &cpu : topology.cpus_ )
+        cpu.node = dense[cpu.node];
+    topology.node_count_ = static_cast<int>( dense.size() );
+
+    std::sort( topology.cpus_.begin(),
+               topology.cpus_.end(),
+               []( const cpu_t &a, const cpu_t &b )
+               { return std::tie( a.node, a.package, a.core, a.id ) < std::tie( b.node, b.package, b.core, b.id ); } );
+    return topology;
+}
+
+const cpu_topology_t &cpu_topology_t::machine()
+{
+    static const cpu_topology_t topology = detect();
+    return topology;
+}
+
+int cpu_topology_t::node_of_cpu( int cpu ) const
+{
+    for( const auto &c : cpus_ )
+    {
+        if( c.id == cpu )
+            return c.node;
+    }
+    return 0;
+}
+
+std::vector<int> cpu_topology_t::node_cpus( int node ) const
+{
+    std::vector<int> ids;
+    for( const auto &cpu : cpus_ )
+    {
+        if( cpu.node == node )
+            ids.push_back( cpu.id );
+    }
+    return ids;
+}
+
+std::vector<int> cpu_topology_t::assign( pin_policy_t policy, unsigned count ) const
+{
+    if( policy == pin_policy_t::none || cpus_.empty() )
+        return {};
+
+    // Per node: the first hardware thread of every core, then the second ones and so on
+    std::vector<std::vector<int>> per_node( node_count_ );
+    for( int node = 0; node < node_count_; node++ )
+    {
+        std::map<std::pair<int, int>, int> seen; // hardware threads so far per package and core
+        std::vector<std::pair<int, int>> ranked; // ( rank, cpu ) in core order
+        for( const auto &cpu : cpus_ )
+        {
+            if( cpu.node == node )
+                ranked.emplace_back( seen[{ cpu.package, cpu.core }]++, cpu.id );
+        }
+        std::stable_sort( ranked.begin(),
+                          ranked.end(),
+                          []( const std::pair<int, int> &a, const std::pair<int, int> &b )
+                          { return a.first < b.first; } );
+        for( const auto &entry : ranked )
+            per_node[node].push_back( entry.second );
+    }
+
+    std::vector<int> order;
+    if( policy == pin_policy_t::compact )
+    {
+        for( const auto &cpus : per_node )
+            order.insert( order.end(), cpus.begin(), cpus.end() );
+    }
+    else
+    {
+        for( size_t i = 0; order.size() < cpus_.size(); i++ )
+        {
+            for( const auto &cpus : per_node )
+            {
+                if( i < cpus.size() )
+                    order.push_back( cpus[i] );
+            }
+        }
+    }
+
+    std::vector<int> assigned( count );
+    for( unsigned i = 0; i < count; i++ )
+        assigned[i] = order[i % order.size()];
+    return assigned;
+}
+
+bool pin_current_thread( const std::vector<int> &cpus )
+{
+#if defined( __linux__ )
+    if( cpus.empty() )
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    for( const int cpu : cpus )
+        CPU_SET( cpu, &set );
+    return pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) == 0;
+#else
+    return false;
+#endif
+}
+
+int current_node()
+{
+#if defined( __linux__ )
+    const int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : cpu_topology_t::machine().node_of_cpu( cpu );
+#else
+    return 0;
+#endif
+}
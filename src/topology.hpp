@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Where worker threads run
+enum class pin_policy_t
+{
+    none,    // wherever the scheduler puts them
+    compact, // one per physical core, filling a node before the next one, then the second hardware threads
+    scatter  // like compact, but taking nodes in turn so every node gets a share of the workers
+};
+
+// Parses none, compact or scatter
+bool parse_pin_policy( const std::string &name, pin_policy_t &policy );
+const char *pin_policy_name( pin_policy_t policy );
+
+// CPUs this process may run on with their core, package and NUMA node, read from sysfs. Where that is not
+// available, one node with hardware_concurrency() CPUs.
+class cpu_topology_t
+{
+public:
+    struct cpu_t
+    {
+        int id;
+        int core;    // physical core within the package
+        int package; // socket
+        int node;    // NUMA node, indexes nodes 0 to node_count() - 1
+    };
+
+    // sys_root is only replaced to read a recorded topology
+    static cpu_topology_t detect( const std::string &sys_root = "/sys/devices/system" );
+
+    // The machine as detected once at first use
+    static const cpu_topology_t &machine();
+
+    const std::vector<cpu_t> &cpus() const
+    {
+        return cpus_;
+    }
+
+    int node_count() const
+    {
+        return node_count_;
+    }
+
+    // Node of a CPU id, 0 for CPUs that are not listed
+    int node_of_cpu( int cpu ) const;
+
+    // CPU ids for count workers, cycling through the list when there are more workers than CPUs. Empty for none.
+    std::vector<int> assign( pin_policy_t policy, unsigned count ) const;
+
+    // CPU ids of a node
+    std::vector<int> node_cpus( int node ) const;
+
+private:
+    std::vector<cpu_t> cpus_; // ordered by node, package, core and id
+    int node_count_{ 1 };
+};
+
+// Restricts the calling thread to one CPU or to a set of them, false where affinity cannot be set
+bool pin_current_thread( const std::vector<int> &cpus );
+
+// NUMA node the calling thread is running on right now
+int current_node();
@@ -0,0 +1,141 @@
+#include "trace.hpp"
+
+#if defined( RAYTRACER_TRACE )
+
+#    include <atomic>
+#    include <chrono>
+#    include <fstream>
+#    include <iomanip>
+#    include <memory>
+#    include <mutex>
+#    include <vector>
+
+namespace
+{
+    struct trace_event_t
+    {
+        const char *name;
+        int64_t arg;
+        int64_t start_ns;
+        int64_t duration_ns;
+    };
+
+    // Each thread appends to its own buffer without locking, buffers outlive their threads
+    struct thread_buffer_t
+    {
+        int tid;
+        std::string name;
+        std::vector<trace_event_t> events;
+    };
+
+    std::atomic<bool> trace_enabled{ false };
+    std::mutex registry_mutex;
+    std::vector<std::unique_ptr<thread_buffer_t>> registry;
+    const auto trace_epoch = std::chrono::steady_clock::now();
+
+    int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - trace_epoch )
+            .count();
+    }
+
+    thread_buffer_t &thread_buffer()
+    {
+        thread_local thread_buffer_t *buffer = nullptr;
+        if( !buffer )
+        {
+            std::lock_guard<std::mutex> lock( registry_mutex );
+            registry.push_back( std::make_unique<thread_buffer_t>() );
+            buffer = registry.back().get();
+            buffer->tid = static_cast<int>( registry.size() );
+            buffer->name = "thread " + std::to_string( buffer->tid );
+            buffer->events.reserve( 4096 );
+        }
+        return *buffer;
+    }
+
+    void write_escaped( std::ostream &out, const std::string &text )
+    {
+        for( const char c : text )
+        {
+            if( c == '"' || c == '\\' )
+                out << '\\';
+            out << c;
+        }
+    }
+} // namespace
+
+bool trace_start()
+{
+    trace_enabled = true;
+    return true;
+}
+
+void trace_set_thread_name( const std::string &name )
+{
+    // Threads that never record anything get no buffer
+    if( !trace_enabled )
+        return;
+    thread_buffer().name = name;
+}
+
+bool trace_write( const std::string &path )
+{
+    std::ofstream out( path );
+
+    std::lock_guard<std::mutex> lock( registry_mutex );
+
+    out << std::fixed << std::setprecision( 3 );
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for( const auto &buffer : registry )
+    {
+        out << ( first ? "" : ",\n" ) << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+            << ",\"args\":{\"name\":\"";
+        write_escaped( out, buffer->name );
+        out << "\"}}";
+        first = false;
+
+        for( const auto &event : buffer->events )
+        {
+            out << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"ts\":" << event.start_ns / 1000.0 << ",\"dur\":" << event.duration_ns / 1000.0;
+            if( event.arg >= 0 )
+                out << ",\"args\":{\"index\":" << event.arg << '}';
+            out << '}';
+        }
+    }
+    out << "\n]}\n";
+
+    return bool( out );
+}
+
+trace_scope_t::trace_scope_t( const char *name, int64_t arg ) : name( name ), arg( arg ), start_ns( -1 )
+{
+    if( trace_enabled.load( std::memory_order_relaxed ) )
+        start_ns = now_ns();
+}
+
+trace_scope_t::~trace_scope_t()
+{
+    if( start_ns >= 0 )
+        thread_buffer().events.push_back( trace_event_t{ name, arg, start_ns, now_ns() - start_ns } );
+}
+
+#else
+
+bool trace_start()
+{
+    return false;
+}
+
+void trace_set_thread_name( const std::string & )
+{
+}
+
+bool trace_write( const std::string & )
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Scoped timeline zones written as a Chrome trace / Perfetto JSON file with one track per thread.
+// Zones are compiled out unless the build defines RAYTRACER_TRACE (cmake -DRAYTRACER_ENABLE_TRACE=ON), and are only
+// recorded after trace_start() has been called. Zone names must be string literals, they are stored as pointers.
+
+#if defined( RAYTRACER_TRACE )
+#    define TRACE_CONCAT_INNER( a, b ) a##b
+#    define TRACE_CONCAT( a, b ) TRACE_CONCAT_INNER( a, b )
+#    define TRACE_SCOPE( name ) trace_scope_t TRACE_CONCAT( trace_scope_, __LINE__ )( name )
+#    define TRACE_SCOPE_ARG( name, arg ) trace_scope_t TRACE_CONCAT( trace_scope_, __LINE__ )( name, arg )
+#else
+#    define TRACE_SCOPE( name ) ( (void)0 )
+#    define TRACE_SCOPE_ARG( name, arg ) ( (void)0 )
+#endif
+
+// Returns false if tracing was compiled out
+bool trace_start();
+
+// Names the calling thread's track, ignored before trace_start()
+void trace_set_thread_name( const std::string &name );
+
+// Writes every zone recorded so far, call it when no other thread is inside a zone. Returns false if tracing is
+// compiled out or the file cannot be written.
+bool trace_write( const std::string &path );
+
+#if defined( RAYTRACER_TRACE )
+class trace_scope_t
+{
+public:
+    explicit trace_scope_t( const char *name, int64_t arg = -1 );
+    ~trace_scope_t();
+
+    trace_scope_t( const trace_scope_t & ) = delete;
+    trace_scope_t &operator=( const trace_scope_t & ) = delete;
+
+private:
+    const char *name;
+    int64_t arg;
+    int64_t start_ns;
+};
+#endif
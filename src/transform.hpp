@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cmath>
+
+#include "vec3.hpp"
+#include "utils.hpp"
+
+// Affine map p -> A p + b, with the rows of the 3x3 matrix A in m[i][0..2] and b in m[i][3]
+class transform_t
+{
+public:
+    double m[3][4]{ { 1.0, 0.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0, 0.0 }, { 0.0, 0.0, 1.0, 0.0 } };
+
+    static transform_t translate( const vec3_t &offset )
+    {
+        transform_t t;
+        t.m[0][3] = offset.x;
+        t.m[1][3] = offset.y;
+        t.m[2][3] = offset.z;
+        return t;
+    }
+
+    static transform_t scale( const vec3_t &factors )
+    {
+        transform_t t;
+        t.m[0][0] = factors.x;
+        t.m[1][1] = factors.y;
+        t.m[2][2] = factors.z;
+        return t;
+    }
+
+    static transform_t rotate_y( double degrees )
+    {
+        const double radians = degrees_to_radians( degrees );
+        transform_t t;
+        t.m[0][0] = std::cos( radians );
+        t.m[0][2] = std::sin( radians );
+        t.m[2][0] = -std::sin( radians );
+        t.m[2][2] = std::cos( radians );
+        return t;
+    }
+
+    point3_t point( const point3_t &p ) const
+    {
+        return point3_t{ m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                         m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                         m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3] };
+    }
+
+    vec3_t vector( const vec3_t &v ) const
+    {
+        return vec3_t{ m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                       m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                       m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z };
+    }
+
+    // A must be invertible
+    transform_t inverse() const
+    {
+        // Adjugate of A over its determinant, then b moved to the other side
+        const double c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        const double c01 = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+        const double c02 = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+        const double c10 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        const double c11 = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+        const double c12 = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+        const double c20 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        const double c21 = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+        const double c22 = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+        const double inv_det = 1.0 / ( m[0][0] * c00 + m[0][1] * c10 + m[0][2] * c20 );
+
+        transform_t t;
+        const double a[3][3] = { { c00, c01, c02 }, { c10, c11, c12 }, { c20, c21, c22 } };
+        for( int i = 0; i < 3; i++ )
+        {
+            for( int j = 0; j < 3; j++ )
+                t.m[i][j] = a[i][j] * inv_det;
+            t.m[i][3] = -( t.m[i][0] * m[0][3] + t.m[i][1] * m[1][3] + t.m[i][2] * m[2][3] );
+        }
+        return t;
+    }
+};
+
+// b first, then a
+inline transform_t operator*( const transform_t &a, const transform_t &b )
+{
+    transform_t t;
+    for( int i = 0; i < 3; i++ )
+    {
+        for( int j = 0; j < 4; j++ )
+        {
+            t.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+            if( j == 3 )
+                t.m[i][j] += a.m[i][3];
+        }
+    }
+    return t;
+}
@@ -83,6 +83,11 @@ vec3_t operator/( const vec3_t &v, const double t )
     return vec3_t{ v.x / t, v.y / t, v.z / t };
 }
 
+bool operator==( const vec3_t &a, const vec3_t &b )
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
 double length( const vec3_t &v )
 {
     return std::sqrt( length_squared( v ) );
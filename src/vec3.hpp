@@ -26,6 +26,7 @@ vec3_t operator*( const vec3_t &a, const vec3_t &b );
 vec3_t operator*( const vec3_t &v, const double t );
 vec3_t operator*( const double t, const vec3_t &v );
 vec3_t operator/( const vec3_t &v, const double t );
+bool operator==( const vec3_t &a, const vec3_t &b );
 
 double length( const vec3_t &v );
 double length_squared( const vec3_t &v );